@@ -0,0 +1,350 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "sim.h"
+
+/* ******************************************************************
+   Benchmark of the emulator and the protocol it is linked with.
+
+   Runs a fixed set of scenarios with a fixed seed at several sizes and
+   prints, for every run, the events dispatched per second of wall clock
+   time, the memory allocations per event and the peak resident set size,
+   together with the goodput and the retransmissions per delivered
+   message.  Each run is done in a child process of its own so the peak
+   RSS is that run's.
+
+   save=FILE stores the results, baseline=FILE compares them with stored
+   ones: a run of at least MINSECONDS that dispatches events more than
+   tolerance= percent slower than the baseline makes the exit status 1.  Events, goodput
+   and retransmissions do not depend on the machine, so a difference in
+   them means the simulation itself changed.  Keep a baseline per
+   protocol: gbn_bench.baseline and sr_bench.baseline are the stored
+   ones, run "gbn_bench baseline=gbn_bench.baseline" to compare and save=
+   to replace them when the simulation is meant to change.
+**********************************************************************/
+
+#define MAXSIZES   16
+#define MAXARG     300
+#define MAXLINE    512
+#define TOLERANCE  10.0     /* percent, default of tolerance= */
+#define MINSECONDS 0.1      /* shorter runs are too noisy to be called slower */
+
+static const struct {
+  const char *name;
+  const char *args;         /* space separated key=value parameters */
+} scenarios[] = {
+  { "clean",    "lambda=20" },
+  { "lossy",    "lambda=20 loss=0.1 corrupt=0.1 direction=2" },
+  { "window32", "lambda=4 loss=0.01 window=32 seqspace=64 bandwidth=64 propdelay=20 "
+                "linkqueue=64 cc=1 queue=1000" },
+  { "flows100", "lambda=100 flows=100 loss=0.02 window=16 seqspace=64 bandwidth=64 "
+                "propdelay=20 linkqueue=200 cc=1 queue=100" },
+};
+#define NSCENARIOS ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+/* what one run measured */
+struct result {
+  int scenario;
+  int messages;
+  long events;
+  double seconds;           /* wall clock time of sim_run() */
+  double eventrate;         /* events per second */
+  double allocs;            /* allocations per event */
+  long rsskb;               /* peak resident set size */
+  double goodput;           /* messages delivered per time unit */
+  double resent;            /* packets resent per delivered message */
+};
+
+static int sizes[MAXSIZES] = { 10000, 100000, 1000000, 10000000 };
+static int nsizes = 4;
+static const char *only = NULL;   /* comma separated scenario names, NULL = all */
+static char **extra;              /* key=value arguments passed to every run */
+static int nextra = 0;
+static int reps = 1;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* is scenario name selected by only= ? */
+static int selected(const char *name)
+{
+  size_t len = strlen(name);
+  const char *p = only;
+
+  if (only == NULL)
+    return 1;
+  while (p != NULL) {
+    if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+      return 1;
+    if ((p = strchr(p, ',')) != NULL)
+      p++;
+  }
+  return 0;
+}
+
+/* run scenario sc with the given number of messages, in this process */
+static void runsim(int sc, int messages, struct result *res)
+{
+  struct sim *s = sim_new();
+  struct sim_results r;
+  struct rusage usage;
+  char arg[MAXARG];
+  const char *p, *end;
+  double t;
+  int i;
+
+  sim_set(s, "trace=0");
+  for (p = scenarios[sc].args; *p != '\0'; p = *end != '\0' ? end + 1 : end) {
+    if ((end = strchr(p, ' ')) == NULL)
+      end = p + strlen(p);
+    sprintf(arg, "%.*s", (int)(end - p), p);
+    sim_set(s, arg);
+  }
+  sprintf(arg, "messages=%d", messages);
+  sim_set(s, arg);
+  for (i = 0; i < nextra; i++)
+    sim_set(s, extra[i]);
+  sim_configure(s, 0);
+
+  t = now();
+  sim_run(s);
+  t = now() - t;
+  sim_results(s, &r);
+  sim_free(s);
+  getrusage(RUSAGE_SELF, &usage);
+
+  res->scenario = sc;
+  res->messages = messages;
+  res->events = r.events;
+  res->seconds = t;
+  res->eventrate = t > 0 ? r.events / t : 0.0;
+  res->allocs = r.events > 0 ? (double)r.allocations / r.events : 0.0;
+  res->rsskb = usage.ru_maxrss;      /* kilobytes on Linux and the BSDs */
+  res->goodput = r.goodput;
+  res->resent = r.messages_delivered > 0 ? (double)r.packets_resent / r.messages_delivered : 0.0;
+}
+
+/* run it in a child process, so that the peak RSS is this run's alone */
+static void run(int sc, int messages, struct result *res)
+{
+  int fd[2], status;
+  pid_t pid;
+  ssize_t n;
+
+  fflush(stdout);
+  if (pipe(fd) != 0 || (pid = fork()) < 0) {
+    printf("unable to start a benchmark run\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(fd[0]);
+    runsim(sc, messages, res);
+    fflush(stdout);
+    _exit(write(fd[1], res, sizeof(*res)) == (ssize_t)sizeof(*res) ? 0 : 1);
+  }
+  close(fd[1]);
+  n = read(fd[0], res, sizeof(*res));
+  close(fd[0]);
+  waitpid(pid, &status, 0);
+  if (n != (ssize_t)sizeof(*res) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("benchmark %s with %d messages failed\n", scenarios[sc].name, messages);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void printheader(int compare)
+{
+  printf("%-10s %9s %10s %8s %10s %8s %8s %9s %8s", "scenario", "messages", "events", "seconds",
+         "Mevents/s", "allocs/1k", "rss_kb", "goodput", "resent");
+  if (compare)
+    printf("  %7s", "speed");
+  printf("\n");
+}
+
+static void printresult(const struct result *r)
+{
+  printf("%-10s %9d %10ld %8.3f %10.3f %8.3f %8ld %9.5f %8.4f", scenarios[r->scenario].name,
+         r->messages, r->events, r->seconds, r->eventrate * 1e-6, r->allocs * 1000.0, r->rsskb,
+         r->goodput, r->resent);
+}
+
+static void save(const char *filename, const struct result *res, int nres)
+{
+  FILE *f = fopen(filename, "w");
+  int i;
+
+  if (f == NULL) {
+    printf("unable to write baseline %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(f, "scenario,messages,events,seconds,events_per_sec,allocs_per_event,peak_rss_kb,"
+          "goodput,resent_per_delivered\n");
+  for (i = 0; i < nres; i++)
+    fprintf(f, "%s,%d,%ld,%f,%f,%f,%ld,%f,%f\n", scenarios[res[i].scenario].name, res[i].messages,
+            res[i].events, res[i].seconds, res[i].eventrate, res[i].allocs, res[i].rsskb,
+            res[i].goodput, res[i].resent);
+  fclose(f);
+}
+
+/* the baseline line of r's scenario and size, 0 if there is none */
+static int findbaseline(FILE *f, const struct result *r, struct result *b)
+{
+  char line[MAXLINE], name[64];
+
+  rewind(f);
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (sscanf(line, "%63[^,],%d,%ld,%lf,%lf,%lf,%ld,%lf,%lf", name, &b->messages, &b->events,
+               &b->seconds, &b->eventrate, &b->allocs, &b->rsskb, &b->goodput, &b->resent) == 9 &&
+        strcmp(name, scenarios[r->scenario].name) == 0 && b->messages == r->messages)
+      return 1;
+  return 0;
+}
+
+/* bench's own key=value arguments, 0 if arg is not one of them */
+static int intlist(const char *arg, const char *key, int *values, int max, int *n)
+{
+  size_t len = strlen(key);
+  const char *p;
+  char *end;
+  double v;
+
+  if (strncmp(arg, key, len) != 0 || arg[len] != '=')
+    return 0;
+  *n = 0;
+  for (p = arg + len + 1; ; p = end + 1) {
+    v = strtod(p, &end);          /* 1e6 is accepted as well */
+    if (end == p || v < 1 || v > 2e9 || (*end != ',' && *end != '\0') || *n == max) {
+      printf("invalid value for %s\n", arg);
+      exit(EXIT_FAILURE);
+    }
+    values[(*n)++] = (int)v;
+    if (*end == '\0')
+      return 1;
+  }
+}
+
+static void usage(const char *prog)
+{
+  int i;
+
+  printf("usage: %s [key=value ...]\n", prog);
+  printf("  sizes=N,N,...   messages per run (default 1e4,1e5,1e6,1e7)\n");
+  printf("  only=NAME,...   run only these scenarios\n");
+  printf("  reps=N          runs of each, the fastest counts (default 1)\n");
+  printf("  save=FILE       store the results as a baseline\n");
+  printf("  baseline=FILE   compare the results with a stored baseline\n");
+  printf("  tolerance=PCT   slowdown that counts as a regression (default %g)\n", TOLERANCE);
+  printf("other parameters are passed to every simulation.  The scenarios:\n");
+  for (i = 0; i < NSCENARIOS; i++)
+    printf("  %-10s %s\n", scenarios[i].name, scenarios[i].args);
+}
+
+int main(int argc, char **argv)
+{
+  const char *savefile = NULL, *basefile = NULL;
+  struct result *res, r, b;
+  double tolerance = TOLERANCE, speed;
+  FILE *basef = NULL;
+  char *arg, *end;
+  int nres = 0, regressions = 0, changed = 0;
+  int i, j, k;
+
+  extra = malloc(argc * sizeof(char *));
+  res = malloc(NSCENARIOS * MAXSIZES * sizeof(struct result));
+  if (extra == 0 || res == 0) {
+    printf("memory allocation failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 1; i < argc; i++) {
+    arg = argv[i];
+    while (*arg == '-')
+      arg++;
+    if (strcmp(arg, "h") == 0 || strcmp(arg, "help") == 0) {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (strchr(arg, '=') == NULL || strlen(arg) >= MAXARG) {
+      printf("unrecognised argument %s\n", argv[i]);
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    if (intlist(arg, "sizes", sizes, MAXSIZES, &nsizes) || intlist(arg, "reps", &reps, 1, &k))
+      continue;
+    if (strncmp(arg, "only=", 5) == 0)
+      only = arg + 5;
+    else if (strncmp(arg, "save=", 5) == 0)
+      savefile = arg + 5;
+    else if (strncmp(arg, "baseline=", 9) == 0)
+      basefile = arg + 9;
+    else if (strncmp(arg, "tolerance=", 10) == 0) {
+      tolerance = strtod(arg + 10, &end);
+      if (arg[10] == '\0' || *end != '\0' || tolerance < 0) {
+        printf("invalid value for %s\n", arg);
+        return EXIT_FAILURE;
+      }
+    }
+    else
+      extra[nextra++] = arg;
+  }
+  if (basefile != NULL && (basef = fopen(basefile, "r")) == NULL) {
+    printf("unable to read baseline %s\n", basefile);
+    return EXIT_FAILURE;
+  }
+
+  printheader(basef != NULL);
+  for (i = 0; i < NSCENARIOS; i++) {
+    if (!selected(scenarios[i].name))
+      continue;
+    for (j = 0; j < nsizes; j++) {
+      for (k = 0; k < reps; k++) {
+        run(i, sizes[j], &r);
+        if (k == 0 || r.seconds < res[nres].seconds)
+          res[nres] = r;
+      }
+      printresult(&res[nres]);
+      if (basef != NULL) {
+        if (!findbaseline(basef, &res[nres], &b))
+          printf("  no baseline");
+        else {
+          speed = b.eventrate > 0 ? res[nres].eventrate / b.eventrate : 0.0;
+          printf("  %6.2fx", speed);
+          if (speed < 1.0 - tolerance / 100.0 && res[nres].seconds >= MINSECONDS) {
+            printf(" SLOWER");
+            regressions++;
+          }
+          /* the baseline has 6 digits after the point */
+          if (b.events != res[nres].events || b.goodput - res[nres].goodput > 1e-6 ||
+              res[nres].goodput - b.goodput > 1e-6 || b.resent - res[nres].resent > 1e-6 ||
+              res[nres].resent - b.resent > 1e-6) {
+            printf(" CHANGED");
+            changed++;
+          }
+        }
+      }
+      printf("\n");
+      nres++;
+    }
+  }
+
+  if (basef != NULL) {
+    fclose(basef);
+    printf("\n%d of %d runs slower than the baseline by more than %g%%", regressions, nres, tolerance);
+    printf(", %d simulated differently\n", changed);
+  }
+  if (savefile != NULL)
+    save(savefile, res, nres);
+  free(res);
+  free(extra);
+  return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
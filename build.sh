@@ -1,4 +1,24 @@
 #!/bin/bash
-gcc -Wall -std=c99 -pedantic -o gbn emulator.c gbn.c
-gcc -Wall -std=c99 -pedantic -o sr  emulator.c sr.c
+gcc -Wall -std=c99 -pedantic -pthread -o gbn main.c emulator.c rto.c cc.c msgqueue.c checksum.c gbn.c -lm
+gcc -Wall -std=c99 -pedantic -pthread -o sr  main.c emulator.c rto.c cc.c msgqueue.c checksum.c sr.c -lm
+
+# production builds: TRACE fixed at 0 so all trace code is compiled out
+gcc -Wall -std=c99 -pedantic -O2 -DTRACE_LEVEL=0 -pthread -o gbn_fast main.c emulator.c rto.c cc.c msgqueue.c checksum.c gbn.c -lm
+gcc -Wall -std=c99 -pedantic -O2 -DTRACE_LEVEL=0 -pthread -o sr_fast  main.c emulator.c rto.c cc.c msgqueue.c checksum.c sr.c -lm
+gcc -Wall -std=c99 -pedantic -O2 -DTRACE_LEVEL=0 -pthread -o gbn_sweep sweep.c emulator.c rto.c cc.c msgqueue.c checksum.c gbn.c -lm
+gcc -Wall -std=c99 -pedantic -O2 -DTRACE_LEVEL=0 -pthread -o sr_sweep  sweep.c emulator.c rto.c cc.c msgqueue.c checksum.c sr.c -lm
+
+# fixed benchmark scenarios, compared with a stored baseline (baseline=gbn_bench.baseline)
+gcc -Wall -std=c99 -pedantic -O2 -DTRACE_LEVEL=0 -o gbn_bench bench.c emulator.c rto.c cc.c msgqueue.c checksum.c gbn.c -lm
+gcc -Wall -std=c99 -pedantic -O2 -DTRACE_LEVEL=0 -o sr_bench  bench.c emulator.c rto.c cc.c msgqueue.c checksum.c sr.c -lm
+
+# the protocols over real UDP sockets instead of the emulator
+gcc -Wall -std=c99 -pedantic -O2 -o gbn_udp udp.c rto.c cc.c msgqueue.c checksum.c gbn.c -lm
+gcc -Wall -std=c99 -pedantic -O2 -o sr_udp  udp.c rto.c cc.c msgqueue.c checksum.c sr.c -lm
+
+# offline analysis of evlog= traces
+gcc -Wall -std=c99 -pedantic -O2 -o evreplay evreplay.c
+
+# speed and error detection of the checksum= algorithms
+gcc -Wall -std=c99 -pedantic -O2 -o cksumbench cksumbench.c checksum.c
 echo "Build finished."
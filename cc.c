@@ -0,0 +1,103 @@
+#include "emulator.h"
+#include "cc.h"
+
+/* ******************************************************************
+   Congestion control (RFC 5681), in packets instead of bytes.
+
+   Below ssthresh the window grows by one packet for every packet ACKed
+   (slow start, doubling every round trip), above it by 1/cwnd (one
+   packet per round trip).  A timeout means the ACK clock has stopped:
+   ssthresh becomes half of what was in flight and the window starts
+   again from one packet.  A fast retransmit halves the window instead,
+   inflated by the packets that the duplicate ACKs say have left the
+   network, and the next new ACK ends the recovery at ssthresh.  A
+   protocol that finds out that a timeout was spurious can undo it.
+**********************************************************************/
+
+static void report(const struct cc *c)
+{
+  protocol_cwnd(c->entity, c->cwnd, c->ssthresh);
+}
+
+/* half the packets in flight, but at least 2 */
+static double half(int flight)
+{
+  return flight / 2.0 > 2.0 ? flight / 2.0 : 2.0;
+}
+
+void cc_init(struct cc *c, int AorB, int maxwindow)
+{
+  c->maxwindow = maxwindow;
+  c->cwnd = CC_INITIAL < maxwindow ? CC_INITIAL : maxwindow;
+  c->ssthresh = maxwindow;
+  c->recovery = false;
+  c->canundo = false;
+  c->entity = AorB;
+  report(c);
+}
+
+int cc_window(const struct cc *c)
+{
+  int w = (int)c->cwnd;
+
+  if (w > c->maxwindow)
+    return c->maxwindow;
+  return w > 1 ? w : 1;
+}
+
+void cc_ack(struct cc *c, int n)
+{
+  if (c->recovery) {       /* new data got through, the recovery is over */
+    c->cwnd = c->ssthresh;
+    c->recovery = false;
+  }
+  else if (c->cwnd < c->ssthresh)
+    c->cwnd += n;
+  else
+    c->cwnd += (double)n / c->cwnd;
+  if (c->cwnd > c->maxwindow)
+    c->cwnd = c->maxwindow;
+  if (c->canundo && c->cwnd >= c->cwnd0)
+    c->canundo = false;
+  report(c);
+}
+
+void cc_timeout(struct cc *c, int flight)
+{
+  if (!c->canundo) {       /* a second timeout keeps the window of before the first */
+    c->cwnd0 = c->cwnd;
+    c->ssthresh0 = c->ssthresh;
+    c->canundo = true;
+  }
+  c->ssthresh = half(flight);
+  c->cwnd = 1.0;
+  c->recovery = false;
+  report(c);
+}
+
+void cc_fastretransmit(struct cc *c, int flight, int dupthresh)
+{
+  c->ssthresh = half(flight);
+  c->cwnd = c->ssthresh + dupthresh;
+  c->recovery = true;
+  c->canundo = false;
+  report(c);
+}
+
+void cc_undo(struct cc *c)
+{
+  if (!c->canundo)
+    return;
+  c->cwnd = c->cwnd0;
+  c->ssthresh = c->ssthresh0;
+  c->canundo = false;
+  report(c);
+}
+
+void cc_dupack(struct cc *c)
+{
+  if (!c->recovery)
+    return;
+  c->cwnd += 1.0;
+  report(c);
+}
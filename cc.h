@@ -0,0 +1,40 @@
+/* Congestion control shared by the protocols, counted in packets:
+   slow start, congestion avoidance (additive increase), multiplicative
+   decrease on a timeout and Reno fast recovery on duplicate ACKs
+   (RFC 5681).  The sender keeps no more than cc_window() packets in its
+   window.  Every change of the window is reported with protocol_cwnd(). */
+
+#include <stdbool.h>
+
+#define CC_INITIAL 2.0     /* initial window, RFC 5681 allows 2 to 4 segments */
+
+struct cc {
+  double cwnd;             /* congestion window */
+  double ssthresh;         /* slow start threshold */
+  int maxwindow;           /* the protocol's window, cwnd does not grow past it */
+  bool recovery;           /* between a fast retransmit and the next new ACK */
+  bool canundo;            /* a timeout shrank the window, cwnd0 and ssthresh0 are from before */
+  double cwnd0, ssthresh0;
+  int entity;              /* A or B, for protocol_cwnd() */
+};
+
+/* the congestion window of entity AorB, whose window is maxwindow packets */
+extern void cc_init(struct cc *, int AorB, int maxwindow);
+
+/* packets allowed in the window, at least 1 */
+extern int cc_window(const struct cc *);
+
+/* n packets were ACKed for the first time */
+extern void cc_ack(struct cc *, int n);
+
+/* the retransmission timer went off with flight packets outstanding */
+extern void cc_timeout(struct cc *, int flight);
+
+/* the last timeout was spurious, nothing had been lost: go back to the
+   window from before it, unless it has grown back already */
+extern void cc_undo(struct cc *);
+
+/* dupthresh duplicate ACKs caused a fast retransmit with flight packets
+   outstanding, and one more duplicate ACK arrived during the recovery */
+extern void cc_fastretransmit(struct cc *, int flight, int dupthresh);
+extern void cc_dupack(struct cc *);
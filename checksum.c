@@ -0,0 +1,404 @@
+#include <stdint.h>
+#include <string.h>
+#include "emulator.h"
+#include "checksum.h"
+
+/* ******************************************************************
+   Packet checksums shared by the protocols.
+
+   - sum: the original byte sum plus seqnum and acknum.  Swapped bytes
+   and errors that cancel out go unnoticed.
+   - inet: the 16 bit ones' complement Internet checksum (RFC 1071),
+   added up a 32 bit word at a time with the carries folded in at the end.
+   - crc32c: CRC-32C (Castagnoli, as in iSCSI and SCTP).  It uses the
+   SSE4.2 or ARMv8 CRC32C instructions when the CPU has them and a
+   slicing-by-4 table otherwise, which also works a 32 bit word at a time.
+
+   inet and crc32c cover seqnum and acknum in network byte order
+   followed by the payload, so the result does not depend on the host.
+**********************************************************************/
+
+#define HDRBYTES (2 * 4)   /* seqnum and acknum */
+
+/* crc32c_table[0] is the byte at a time table for the reflected
+   polynomial 0x82F63B78, crc32c_table[k][i] is crc32c_table[0][i]
+   advanced by k more zero bytes */
+static const uint32_t crc32c_table[4][256] = {
+  {
+    0x00000000U, 0xf26b8303U, 0xe13b70f7U, 0x1350f3f4U, 0xc79a971fU, 0x35f1141cU,
+    0x26a1e7e8U, 0xd4ca64ebU, 0x8ad958cfU, 0x78b2dbccU, 0x6be22838U, 0x9989ab3bU,
+    0x4d43cfd0U, 0xbf284cd3U, 0xac78bf27U, 0x5e133c24U, 0x105ec76fU, 0xe235446cU,
+    0xf165b798U, 0x030e349bU, 0xd7c45070U, 0x25afd373U, 0x36ff2087U, 0xc494a384U,
+    0x9a879fa0U, 0x68ec1ca3U, 0x7bbcef57U, 0x89d76c54U, 0x5d1d08bfU, 0xaf768bbcU,
+    0xbc267848U, 0x4e4dfb4bU, 0x20bd8edeU, 0xd2d60dddU, 0xc186fe29U, 0x33ed7d2aU,
+    0xe72719c1U, 0x154c9ac2U, 0x061c6936U, 0xf477ea35U, 0xaa64d611U, 0x580f5512U,
+    0x4b5fa6e6U, 0xb93425e5U, 0x6dfe410eU, 0x9f95c20dU, 0x8cc531f9U, 0x7eaeb2faU,
+    0x30e349b1U, 0xc288cab2U, 0xd1d83946U, 0x23b3ba45U, 0xf779deaeU, 0x05125dadU,
+    0x1642ae59U, 0xe4292d5aU, 0xba3a117eU, 0x4851927dU, 0x5b016189U, 0xa96ae28aU,
+    0x7da08661U, 0x8fcb0562U, 0x9c9bf696U, 0x6ef07595U, 0x417b1dbcU, 0xb3109ebfU,
+    0xa0406d4bU, 0x522bee48U, 0x86e18aa3U, 0x748a09a0U, 0x67dafa54U, 0x95b17957U,
+    0xcba24573U, 0x39c9c670U, 0x2a993584U, 0xd8f2b687U, 0x0c38d26cU, 0xfe53516fU,
+    0xed03a29bU, 0x1f682198U, 0x5125dad3U, 0xa34e59d0U, 0xb01eaa24U, 0x42752927U,
+    0x96bf4dccU, 0x64d4cecfU, 0x77843d3bU, 0x85efbe38U, 0xdbfc821cU, 0x2997011fU,
+    0x3ac7f2ebU, 0xc8ac71e8U, 0x1c661503U, 0xee0d9600U, 0xfd5d65f4U, 0x0f36e6f7U,
+    0x61c69362U, 0x93ad1061U, 0x80fde395U, 0x72966096U, 0xa65c047dU, 0x5437877eU,
+    0x4767748aU, 0xb50cf789U, 0xeb1fcbadU, 0x197448aeU, 0x0a24bb5aU, 0xf84f3859U,
+    0x2c855cb2U, 0xdeeedfb1U, 0xcdbe2c45U, 0x3fd5af46U, 0x7198540dU, 0x83f3d70eU,
+    0x90a324faU, 0x62c8a7f9U, 0xb602c312U, 0x44694011U, 0x5739b3e5U, 0xa55230e6U,
+    0xfb410cc2U, 0x092a8fc1U, 0x1a7a7c35U, 0xe811ff36U, 0x3cdb9bddU, 0xceb018deU,
+    0xdde0eb2aU, 0x2f8b6829U, 0x82f63b78U, 0x709db87bU, 0x63cd4b8fU, 0x91a6c88cU,
+    0x456cac67U, 0xb7072f64U, 0xa457dc90U, 0x563c5f93U, 0x082f63b7U, 0xfa44e0b4U,
+    0xe9141340U, 0x1b7f9043U, 0xcfb5f4a8U, 0x3dde77abU, 0x2e8e845fU, 0xdce5075cU,
+    0x92a8fc17U, 0x60c37f14U, 0x73938ce0U, 0x81f80fe3U, 0x55326b08U, 0xa759e80bU,
+    0xb4091bffU, 0x466298fcU, 0x1871a4d8U, 0xea1a27dbU, 0xf94ad42fU, 0x0b21572cU,
+    0xdfeb33c7U, 0x2d80b0c4U, 0x3ed04330U, 0xccbbc033U, 0xa24bb5a6U, 0x502036a5U,
+    0x4370c551U, 0xb11b4652U, 0x65d122b9U, 0x97baa1baU, 0x84ea524eU, 0x7681d14dU,
+    0x2892ed69U, 0xdaf96e6aU, 0xc9a99d9eU, 0x3bc21e9dU, 0xef087a76U, 0x1d63f975U,
+    0x0e330a81U, 0xfc588982U, 0xb21572c9U, 0x407ef1caU, 0x532e023eU, 0xa145813dU,
+    0x758fe5d6U, 0x87e466d5U, 0x94b49521U, 0x66df1622U, 0x38cc2a06U, 0xcaa7a905U,
+    0xd9f75af1U, 0x2b9cd9f2U, 0xff56bd19U, 0x0d3d3e1aU, 0x1e6dcdeeU, 0xec064eedU,
+    0xc38d26c4U, 0x31e6a5c7U, 0x22b65633U, 0xd0ddd530U, 0x0417b1dbU, 0xf67c32d8U,
+    0xe52cc12cU, 0x1747422fU, 0x49547e0bU, 0xbb3ffd08U, 0xa86f0efcU, 0x5a048dffU,
+    0x8ecee914U, 0x7ca56a17U, 0x6ff599e3U, 0x9d9e1ae0U, 0xd3d3e1abU, 0x21b862a8U,
+    0x32e8915cU, 0xc083125fU, 0x144976b4U, 0xe622f5b7U, 0xf5720643U, 0x07198540U,
+    0x590ab964U, 0xab613a67U, 0xb831c993U, 0x4a5a4a90U, 0x9e902e7bU, 0x6cfbad78U,
+    0x7fab5e8cU, 0x8dc0dd8fU, 0xe330a81aU, 0x115b2b19U, 0x020bd8edU, 0xf0605beeU,
+    0x24aa3f05U, 0xd6c1bc06U, 0xc5914ff2U, 0x37faccf1U, 0x69e9f0d5U, 0x9b8273d6U,
+    0x88d28022U, 0x7ab90321U, 0xae7367caU, 0x5c18e4c9U, 0x4f48173dU, 0xbd23943eU,
+    0xf36e6f75U, 0x0105ec76U, 0x12551f82U, 0xe03e9c81U, 0x34f4f86aU, 0xc69f7b69U,
+    0xd5cf889dU, 0x27a40b9eU, 0x79b737baU, 0x8bdcb4b9U, 0x988c474dU, 0x6ae7c44eU,
+    0xbe2da0a5U, 0x4c4623a6U, 0x5f16d052U, 0xad7d5351U
+  },
+  {
+    0x00000000U, 0x13a29877U, 0x274530eeU, 0x34e7a899U, 0x4e8a61dcU, 0x5d28f9abU,
+    0x69cf5132U, 0x7a6dc945U, 0x9d14c3b8U, 0x8eb65bcfU, 0xba51f356U, 0xa9f36b21U,
+    0xd39ea264U, 0xc03c3a13U, 0xf4db928aU, 0xe7790afdU, 0x3fc5f181U, 0x2c6769f6U,
+    0x1880c16fU, 0x0b225918U, 0x714f905dU, 0x62ed082aU, 0x560aa0b3U, 0x45a838c4U,
+    0xa2d13239U, 0xb173aa4eU, 0x859402d7U, 0x96369aa0U, 0xec5b53e5U, 0xfff9cb92U,
+    0xcb1e630bU, 0xd8bcfb7cU, 0x7f8be302U, 0x6c297b75U, 0x58ced3ecU, 0x4b6c4b9bU,
+    0x310182deU, 0x22a31aa9U, 0x1644b230U, 0x05e62a47U, 0xe29f20baU, 0xf13db8cdU,
+    0xc5da1054U, 0xd6788823U, 0xac154166U, 0xbfb7d911U, 0x8b507188U, 0x98f2e9ffU,
+    0x404e1283U, 0x53ec8af4U, 0x670b226dU, 0x74a9ba1aU, 0x0ec4735fU, 0x1d66eb28U,
+    0x298143b1U, 0x3a23dbc6U, 0xdd5ad13bU, 0xcef8494cU, 0xfa1fe1d5U, 0xe9bd79a2U,
+    0x93d0b0e7U, 0x80722890U, 0xb4958009U, 0xa737187eU, 0xff17c604U, 0xecb55e73U,
+    0xd852f6eaU, 0xcbf06e9dU, 0xb19da7d8U, 0xa23f3fafU, 0x96d89736U, 0x857a0f41U,
+    0x620305bcU, 0x71a19dcbU, 0x45463552U, 0x56e4ad25U, 0x2c896460U, 0x3f2bfc17U,
+    0x0bcc548eU, 0x186eccf9U, 0xc0d23785U, 0xd370aff2U, 0xe797076bU, 0xf4359f1cU,
+    0x8e585659U, 0x9dface2eU, 0xa91d66b7U, 0xbabffec0U, 0x5dc6f43dU, 0x4e646c4aU,
+    0x7a83c4d3U, 0x69215ca4U, 0x134c95e1U, 0x00ee0d96U, 0x3409a50fU, 0x27ab3d78U,
+    0x809c2506U, 0x933ebd71U, 0xa7d915e8U, 0xb47b8d9fU, 0xce1644daU, 0xddb4dcadU,
+    0xe9537434U, 0xfaf1ec43U, 0x1d88e6beU, 0x0e2a7ec9U, 0x3acdd650U, 0x296f4e27U,
+    0x53028762U, 0x40a01f15U, 0x7447b78cU, 0x67e52ffbU, 0xbf59d487U, 0xacfb4cf0U,
+    0x981ce469U, 0x8bbe7c1eU, 0xf1d3b55bU, 0xe2712d2cU, 0xd69685b5U, 0xc5341dc2U,
+    0x224d173fU, 0x31ef8f48U, 0x050827d1U, 0x16aabfa6U, 0x6cc776e3U, 0x7f65ee94U,
+    0x4b82460dU, 0x5820de7aU, 0xfbc3faf9U, 0xe861628eU, 0xdc86ca17U, 0xcf245260U,
+    0xb5499b25U, 0xa6eb0352U, 0x920cabcbU, 0x81ae33bcU, 0x66d73941U, 0x7575a136U,
+    0x419209afU, 0x523091d8U, 0x285d589dU, 0x3bffc0eaU, 0x0f186873U, 0x1cbaf004U,
+    0xc4060b78U, 0xd7a4930fU, 0xe3433b96U, 0xf0e1a3e1U, 0x8a8c6aa4U, 0x992ef2d3U,
+    0xadc95a4aU, 0xbe6bc23dU, 0x5912c8c0U, 0x4ab050b7U, 0x7e57f82eU, 0x6df56059U,
+    0x1798a91cU, 0x043a316bU, 0x30dd99f2U, 0x237f0185U, 0x844819fbU, 0x97ea818cU,
+    0xa30d2915U, 0xb0afb162U, 0xcac27827U, 0xd960e050U, 0xed8748c9U, 0xfe25d0beU,
+    0x195cda43U, 0x0afe4234U, 0x3e19eaadU, 0x2dbb72daU, 0x57d6bb9fU, 0x447423e8U,
+    0x70938b71U, 0x63311306U, 0xbb8de87aU, 0xa82f700dU, 0x9cc8d894U, 0x8f6a40e3U,
+    0xf50789a6U, 0xe6a511d1U, 0xd242b948U, 0xc1e0213fU, 0x26992bc2U, 0x353bb3b5U,
+    0x01dc1b2cU, 0x127e835bU, 0x68134a1eU, 0x7bb1d269U, 0x4f567af0U, 0x5cf4e287U,
+    0x04d43cfdU, 0x1776a48aU, 0x23910c13U, 0x30339464U, 0x4a5e5d21U, 0x59fcc556U,
+    0x6d1b6dcfU, 0x7eb9f5b8U, 0x99c0ff45U, 0x8a626732U, 0xbe85cfabU, 0xad2757dcU,
+    0xd74a9e99U, 0xc4e806eeU, 0xf00fae77U, 0xe3ad3600U, 0x3b11cd7cU, 0x28b3550bU,
+    0x1c54fd92U, 0x0ff665e5U, 0x759baca0U, 0x663934d7U, 0x52de9c4eU, 0x417c0439U,
+    0xa6050ec4U, 0xb5a796b3U, 0x81403e2aU, 0x92e2a65dU, 0xe88f6f18U, 0xfb2df76fU,
+    0xcfca5ff6U, 0xdc68c781U, 0x7b5fdfffU, 0x68fd4788U, 0x5c1aef11U, 0x4fb87766U,
+    0x35d5be23U, 0x26772654U, 0x12908ecdU, 0x013216baU, 0xe64b1c47U, 0xf5e98430U,
+    0xc10e2ca9U, 0xd2acb4deU, 0xa8c17d9bU, 0xbb63e5ecU, 0x8f844d75U, 0x9c26d502U,
+    0x449a2e7eU, 0x5738b609U, 0x63df1e90U, 0x707d86e7U, 0x0a104fa2U, 0x19b2d7d5U,
+    0x2d557f4cU, 0x3ef7e73bU, 0xd98eedc6U, 0xca2c75b1U, 0xfecbdd28U, 0xed69455fU,
+    0x97048c1aU, 0x84a6146dU, 0xb041bcf4U, 0xa3e32483U
+  },
+  {
+    0x00000000U, 0xa541927eU, 0x4f6f520dU, 0xea2ec073U, 0x9edea41aU, 0x3b9f3664U,
+    0xd1b1f617U, 0x74f06469U, 0x38513ec5U, 0x9d10acbbU, 0x773e6cc8U, 0xd27ffeb6U,
+    0xa68f9adfU, 0x03ce08a1U, 0xe9e0c8d2U, 0x4ca15aacU, 0x70a27d8aU, 0xd5e3eff4U,
+    0x3fcd2f87U, 0x9a8cbdf9U, 0xee7cd990U, 0x4b3d4beeU, 0xa1138b9dU, 0x045219e3U,
+    0x48f3434fU, 0xedb2d131U, 0x079c1142U, 0xa2dd833cU, 0xd62de755U, 0x736c752bU,
+    0x9942b558U, 0x3c032726U, 0xe144fb14U, 0x4405696aU, 0xae2ba919U, 0x0b6a3b67U,
+    0x7f9a5f0eU, 0xdadbcd70U, 0x30f50d03U, 0x95b49f7dU, 0xd915c5d1U, 0x7c5457afU,
+    0x967a97dcU, 0x333b05a2U, 0x47cb61cbU, 0xe28af3b5U, 0x08a433c6U, 0xade5a1b8U,
+    0x91e6869eU, 0x34a714e0U, 0xde89d493U, 0x7bc846edU, 0x0f382284U, 0xaa79b0faU,
+    0x40577089U, 0xe516e2f7U, 0xa9b7b85bU, 0x0cf62a25U, 0xe6d8ea56U, 0x43997828U,
+    0x37691c41U, 0x92288e3fU, 0x78064e4cU, 0xdd47dc32U, 0xc76580d9U, 0x622412a7U,
+    0x880ad2d4U, 0x2d4b40aaU, 0x59bb24c3U, 0xfcfab6bdU, 0x16d476ceU, 0xb395e4b0U,
+    0xff34be1cU, 0x5a752c62U, 0xb05bec11U, 0x151a7e6fU, 0x61ea1a06U, 0xc4ab8878U,
+    0x2e85480bU, 0x8bc4da75U, 0xb7c7fd53U, 0x12866f2dU, 0xf8a8af5eU, 0x5de93d20U,
+    0x29195949U, 0x8c58cb37U, 0x66760b44U, 0xc337993aU, 0x8f96c396U, 0x2ad751e8U,
+    0xc0f9919bU, 0x65b803e5U, 0x1148678cU, 0xb409f5f2U, 0x5e273581U, 0xfb66a7ffU,
+    0x26217bcdU, 0x8360e9b3U, 0x694e29c0U, 0xcc0fbbbeU, 0xb8ffdfd7U, 0x1dbe4da9U,
+    0xf7908ddaU, 0x52d11fa4U, 0x1e704508U, 0xbb31d776U, 0x511f1705U, 0xf45e857bU,
+    0x80aee112U, 0x25ef736cU, 0xcfc1b31fU, 0x6a802161U, 0x56830647U, 0xf3c29439U,
+    0x19ec544aU, 0xbcadc634U, 0xc85da25dU, 0x6d1c3023U, 0x8732f050U, 0x2273622eU,
+    0x6ed23882U, 0xcb93aafcU, 0x21bd6a8fU, 0x84fcf8f1U, 0xf00c9c98U, 0x554d0ee6U,
+    0xbf63ce95U, 0x1a225cebU, 0x8b277743U, 0x2e66e53dU, 0xc448254eU, 0x6109b730U,
+    0x15f9d359U, 0xb0b84127U, 0x5a968154U, 0xffd7132aU, 0xb3764986U, 0x1637dbf8U,
+    0xfc191b8bU, 0x595889f5U, 0x2da8ed9cU, 0x88e97fe2U, 0x62c7bf91U, 0xc7862defU,
+    0xfb850ac9U, 0x5ec498b7U, 0xb4ea58c4U, 0x11abcabaU, 0x655baed3U, 0xc01a3cadU,
+    0x2a34fcdeU, 0x8f756ea0U, 0xc3d4340cU, 0x6695a672U, 0x8cbb6601U, 0x29faf47fU,
+    0x5d0a9016U, 0xf84b0268U, 0x1265c21bU, 0xb7245065U, 0x6a638c57U, 0xcf221e29U,
+    0x250cde5aU, 0x804d4c24U, 0xf4bd284dU, 0x51fcba33U, 0xbbd27a40U, 0x1e93e83eU,
+    0x5232b292U, 0xf77320ecU, 0x1d5de09fU, 0xb81c72e1U, 0xccec1688U, 0x69ad84f6U,
+    0x83834485U, 0x26c2d6fbU, 0x1ac1f1ddU, 0xbf8063a3U, 0x55aea3d0U, 0xf0ef31aeU,
+    0x841f55c7U, 0x215ec7b9U, 0xcb7007caU, 0x6e3195b4U, 0x2290cf18U, 0x87d15d66U,
+    0x6dff9d15U, 0xc8be0f6bU, 0xbc4e6b02U, 0x190ff97cU, 0xf321390fU, 0x5660ab71U,
+    0x4c42f79aU, 0xe90365e4U, 0x032da597U, 0xa66c37e9U, 0xd29c5380U, 0x77ddc1feU,
+    0x9df3018dU, 0x38b293f3U, 0x7413c95fU, 0xd1525b21U, 0x3b7c9b52U, 0x9e3d092cU,
+    0xeacd6d45U, 0x4f8cff3bU, 0xa5a23f48U, 0x00e3ad36U, 0x3ce08a10U, 0x99a1186eU,
+    0x738fd81dU, 0xd6ce4a63U, 0xa23e2e0aU, 0x077fbc74U, 0xed517c07U, 0x4810ee79U,
+    0x04b1b4d5U, 0xa1f026abU, 0x4bdee6d8U, 0xee9f74a6U, 0x9a6f10cfU, 0x3f2e82b1U,
+    0xd50042c2U, 0x7041d0bcU, 0xad060c8eU, 0x08479ef0U, 0xe2695e83U, 0x4728ccfdU,
+    0x33d8a894U, 0x96993aeaU, 0x7cb7fa99U, 0xd9f668e7U, 0x9557324bU, 0x3016a035U,
+    0xda386046U, 0x7f79f238U, 0x0b899651U, 0xaec8042fU, 0x44e6c45cU, 0xe1a75622U,
+    0xdda47104U, 0x78e5e37aU, 0x92cb2309U, 0x378ab177U, 0x437ad51eU, 0xe63b4760U,
+    0x0c158713U, 0xa954156dU, 0xe5f54fc1U, 0x40b4ddbfU, 0xaa9a1dccU, 0x0fdb8fb2U,
+    0x7b2bebdbU, 0xde6a79a5U, 0x3444b9d6U, 0x91052ba8U
+  },
+  {
+    0x00000000U, 0xdd45aab8U, 0xbf672381U, 0x62228939U, 0x7b2231f3U, 0xa6679b4bU,
+    0xc4451272U, 0x1900b8caU, 0xf64463e6U, 0x2b01c95eU, 0x49234067U, 0x9466eadfU,
+    0x8d665215U, 0x5023f8adU, 0x32017194U, 0xef44db2cU, 0xe964b13dU, 0x34211b85U,
+    0x560392bcU, 0x8b463804U, 0x924680ceU, 0x4f032a76U, 0x2d21a34fU, 0xf06409f7U,
+    0x1f20d2dbU, 0xc2657863U, 0xa047f15aU, 0x7d025be2U, 0x6402e328U, 0xb9474990U,
+    0xdb65c0a9U, 0x06206a11U, 0xd725148bU, 0x0a60be33U, 0x6842370aU, 0xb5079db2U,
+    0xac072578U, 0x71428fc0U, 0x136006f9U, 0xce25ac41U, 0x2161776dU, 0xfc24ddd5U,
+    0x9e0654ecU, 0x4343fe54U, 0x5a43469eU, 0x8706ec26U, 0xe524651fU, 0x3861cfa7U,
+    0x3e41a5b6U, 0xe3040f0eU, 0x81268637U, 0x5c632c8fU, 0x45639445U, 0x98263efdU,
+    0xfa04b7c4U, 0x27411d7cU, 0xc805c650U, 0x15406ce8U, 0x7762e5d1U, 0xaa274f69U,
+    0xb327f7a3U, 0x6e625d1bU, 0x0c40d422U, 0xd1057e9aU, 0xaba65fe7U, 0x76e3f55fU,
+    0x14c17c66U, 0xc984d6deU, 0xd0846e14U, 0x0dc1c4acU, 0x6fe34d95U, 0xb2a6e72dU,
+    0x5de23c01U, 0x80a796b9U, 0xe2851f80U, 0x3fc0b538U, 0x26c00df2U, 0xfb85a74aU,
+    0x99a72e73U, 0x44e284cbU, 0x42c2eedaU, 0x9f874462U, 0xfda5cd5bU, 0x20e067e3U,
+    0x39e0df29U, 0xe4a57591U, 0x8687fca8U, 0x5bc25610U, 0xb4868d3cU, 0x69c32784U,
+    0x0be1aebdU, 0xd6a40405U, 0xcfa4bccfU, 0x12e11677U, 0x70c39f4eU, 0xad8635f6U,
+    0x7c834b6cU, 0xa1c6e1d4U, 0xc3e468edU, 0x1ea1c255U, 0x07a17a9fU, 0xdae4d027U,
+    0xb8c6591eU, 0x6583f3a6U, 0x8ac7288aU, 0x57828232U, 0x35a00b0bU, 0xe8e5a1b3U,
+    0xf1e51979U, 0x2ca0b3c1U, 0x4e823af8U, 0x93c79040U, 0x95e7fa51U, 0x48a250e9U,
+    0x2a80d9d0U, 0xf7c57368U, 0xeec5cba2U, 0x3380611aU, 0x51a2e823U, 0x8ce7429bU,
+    0x63a399b7U, 0xbee6330fU, 0xdcc4ba36U, 0x0181108eU, 0x1881a844U, 0xc5c402fcU,
+    0xa7e68bc5U, 0x7aa3217dU, 0x52a0c93fU, 0x8fe56387U, 0xedc7eabeU, 0x30824006U,
+    0x2982f8ccU, 0xf4c75274U, 0x96e5db4dU, 0x4ba071f5U, 0xa4e4aad9U, 0x79a10061U,
+    0x1b838958U, 0xc6c623e0U, 0xdfc69b2aU, 0x02833192U, 0x60a1b8abU, 0xbde41213U,
+    0xbbc47802U, 0x6681d2baU, 0x04a35b83U, 0xd9e6f13bU, 0xc0e649f1U, 0x1da3e349U,
+    0x7f816a70U, 0xa2c4c0c8U, 0x4d801be4U, 0x90c5b15cU, 0xf2e73865U, 0x2fa292ddU,
+    0x36a22a17U, 0xebe780afU, 0x89c50996U, 0x5480a32eU, 0x8585ddb4U, 0x58c0770cU,
+    0x3ae2fe35U, 0xe7a7548dU, 0xfea7ec47U, 0x23e246ffU, 0x41c0cfc6U, 0x9c85657eU,
+    0x73c1be52U, 0xae8414eaU, 0xcca69dd3U, 0x11e3376bU, 0x08e38fa1U, 0xd5a62519U,
+    0xb784ac20U, 0x6ac10698U, 0x6ce16c89U, 0xb1a4c631U, 0xd3864f08U, 0x0ec3e5b0U,
+    0x17c35d7aU, 0xca86f7c2U, 0xa8a47efbU, 0x75e1d443U, 0x9aa50f6fU, 0x47e0a5d7U,
+    0x25c22ceeU, 0xf8878656U, 0xe1873e9cU, 0x3cc29424U, 0x5ee01d1dU, 0x83a5b7a5U,
+    0xf90696d8U, 0x24433c60U, 0x4661b559U, 0x9b241fe1U, 0x8224a72bU, 0x5f610d93U,
+    0x3d4384aaU, 0xe0062e12U, 0x0f42f53eU, 0xd2075f86U, 0xb025d6bfU, 0x6d607c07U,
+    0x7460c4cdU, 0xa9256e75U, 0xcb07e74cU, 0x16424df4U, 0x106227e5U, 0xcd278d5dU,
+    0xaf050464U, 0x7240aedcU, 0x6b401616U, 0xb605bcaeU, 0xd4273597U, 0x09629f2fU,
+    0xe6264403U, 0x3b63eebbU, 0x59416782U, 0x8404cd3aU, 0x9d0475f0U, 0x4041df48U,
+    0x22635671U, 0xff26fcc9U, 0x2e238253U, 0xf36628ebU, 0x9144a1d2U, 0x4c010b6aU,
+    0x5501b3a0U, 0x88441918U, 0xea669021U, 0x37233a99U, 0xd867e1b5U, 0x05224b0dU,
+    0x6700c234U, 0xba45688cU, 0xa345d046U, 0x7e007afeU, 0x1c22f3c7U, 0xc167597fU,
+    0xc747336eU, 0x1a0299d6U, 0x782010efU, 0xa565ba57U, 0xbc65029dU, 0x6120a825U,
+    0x0302211cU, 0xde478ba4U, 0x31035088U, 0xec46fa30U, 0x8e647309U, 0x5321d9b1U,
+    0x4a21617bU, 0x9764cbc3U, 0xf54642faU, 0x2803e842U
+  }
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+
+#define CRC32C_HW "sse4.2"
+
+static int crc32c_hwok(void)
+{
+  return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint32_t w;
+#ifdef __x86_64__
+  uint64_t w64;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    memcpy(&w64, p, 8);
+    crc = (uint32_t)_mm_crc32_u64(crc, w64);
+  }
+#endif
+  for (; len >= 4; p += 4, len -= 4) {
+    memcpy(&w, p, 4);
+    crc = _mm_crc32_u32(crc, w);
+  }
+  for (; len > 0; p++, len--)
+    crc = _mm_crc32_u8(crc, *p);
+  return crc;
+}
+
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+
+#define CRC32C_HW "armv8"
+
+static int crc32c_hwok(void)
+{
+  return 1;     /* the compiler was told the CPU has them */
+}
+
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t w;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    memcpy(&w, p, 8);
+    crc = __crc32cd(crc, w);
+  }
+  for (; len > 0; p++, len--)
+    crc = __crc32cb(crc, *p);
+  return crc;
+}
+#endif
+
+int checksum_kind(const char *name)
+{
+  if (strcmp(name, "sum") == 0)
+    return CHECKSUM_SUM;
+  if (strcmp(name, "inet") == 0)
+    return CHECKSUM_INET;
+  if (strcmp(name, "crc32c") == 0)
+    return CHECKSUM_CRC32C;
+  return -1;
+}
+
+int checksum_sum(const void *data, size_t len)
+{
+  const char *p = data;
+  int sum = 0;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    sum += (int)p[i];
+  return sum;
+}
+
+/* the ones' complement sum does not care where the carries go in, so
+   add whole words in host order and fold the carries in afterwards.
+   Only the last piece of a checksum may have a length that is not a
+   multiple of 4. */
+static uint64_t inet_add(uint64_t sum, const unsigned char *p, size_t len)
+{
+  uint32_t w;
+  uint16_t h;
+
+  for (; len >= 4; p += 4, len -= 4) {
+    memcpy(&w, p, 4);
+    sum += w;
+  }
+  if (len >= 2) {
+    memcpy(&h, p, 2);
+    sum += h;
+    p += 2;
+    len -= 2;
+  }
+  if (len > 0) {          /* an odd byte is padded with a zero byte */
+    h = 0;
+    memcpy(&h, p, 1);
+    sum += h;
+  }
+  return sum;
+}
+
+static uint16_t inet_fold(uint64_t sum)
+{
+  const uint16_t one = 1;
+  uint16_t h;
+
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+
+  /* the words were added in host order, the checksum is defined in network order */
+  h = (uint16_t)sum;
+  if (*(const unsigned char *)&one == 1)
+    h = (uint16_t)(h << 8 | h >> 8);
+  return (uint16_t)~h;
+}
+
+uint16_t checksum_inet(const void *data, size_t len)
+{
+  return inet_fold(inet_add(0, data, len));
+}
+
+/* the CRC register after len more bytes, without the final inversion */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  for (; len >= 4; p += 4, len -= 4) {
+    crc ^= (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    crc = crc32c_table[3][crc & 0xff] ^ crc32c_table[2][(crc >> 8) & 0xff] ^
+          crc32c_table[1][(crc >> 16) & 0xff] ^ crc32c_table[0][crc >> 24];
+  }
+  for (; len > 0; p++, len--)
+    crc = crc32c_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+uint32_t checksum_crc32c_sw(const void *data, size_t len)
+{
+  return ~crc32c_sw(0xffffffffU, data, len);
+}
+
+static uint32_t crc32c_update(uint32_t crc, const unsigned char *p, size_t len)
+{
+#ifdef CRC32C_HW
+  if (crc32c_hwok())
+    return crc32c_hw(crc, p, len);
+#endif
+  return crc32c_sw(crc, p, len);
+}
+
+uint32_t checksum_crc32c(const void *data, size_t len)
+{
+  return ~crc32c_update(0xffffffffU, data, len);
+}
+
+const char *checksum_crc32c_impl(void)
+{
+#ifdef CRC32C_HW
+  if (crc32c_hwok())
+    return CRC32C_HW;
+#endif
+  return "slicing-by-4";
+}
+
+/* seqnum and acknum in network byte order, the payload follows them */
+static void headerbytes(const struct pkt *packet, unsigned char *bytes)
+{
+  uint32_t seqnum = (uint32_t)packet->seqnum;
+  uint32_t acknum = (uint32_t)packet->acknum;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    bytes[i] = (seqnum >> (24 - 8 * i)) & 0xff;
+    bytes[4 + i] = (acknum >> (24 - 8 * i)) & 0xff;
+  }
+}
+
+/* the header is a whole number of words, so the payload is checksummed
+   where it is instead of being copied behind it */
+int checksum_packet(int kind, const struct pkt *packet, size_t len)
+{
+  const unsigned char *payload = (const unsigned char *)packet->payload;
+  unsigned char bytes[HDRBYTES];
+
+  switch (kind) {
+  case CHECKSUM_INET:
+    headerbytes(packet, bytes);
+    return inet_fold(inet_add(inet_add(0, bytes, HDRBYTES), payload, len));
+  case CHECKSUM_CRC32C:
+    headerbytes(packet, bytes);
+    return (int)~crc32c_update(crc32c_update(0xffffffffU, bytes, HDRBYTES), payload, len);
+  default:
+    return packet->seqnum + packet->acknum + checksum_sum(packet->payload, len);
+  }
+}
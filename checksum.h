@@ -0,0 +1,29 @@
+/* Packet checksums shared by the protocols, chosen at run time with
+   checksum=sum|inet|crc32c. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct pkt;                /* see emulator.h */
+
+enum checksum_kind {
+  CHECKSUM_SUM,            /* seqnum + acknum + the payload bytes, the original */
+  CHECKSUM_INET,           /* 16 bit ones' complement Internet checksum */
+  CHECKSUM_CRC32C          /* CRC-32C, in hardware where the CPU has it */
+};
+
+/* the kind called name, -1 if there is none */
+extern int checksum_kind(const char *name);
+
+/* the checksum of kind over the header fields and the first len bytes */
+/* of the payload of a packet                                          */
+extern int checksum_packet(int kind, const struct pkt *, size_t len);
+
+/* the checksums over any len bytes */
+extern int checksum_sum(const void *, size_t len);
+extern uint16_t checksum_inet(const void *, size_t len);
+extern uint32_t checksum_crc32c(const void *, size_t len);
+extern uint32_t checksum_crc32c_sw(const void *, size_t len);   /* never the hardware */
+
+/* how checksum_crc32c() works on this CPU: sse4.2, armv8 or slicing-by-4 */
+extern const char *checksum_crc32c_impl(void);
@@ -0,0 +1,43 @@
+#!/bin/bash
+# A run restored from a checkpoint must end exactly like the same run
+# without one.  Run after build.sh; the exit status is 1 if a scenario
+# differs.  peak_events and allocations are left out of the comparison:
+# they count this process' event pool and mallocs, which a restore
+# builds anew.
+cd "$(dirname "$0")"
+img=$(mktemp)
+trap 'rm -f "$img"' EXIT
+failed=0
+
+scenarios=(
+  "400 messages=2000 lambda=10 loss=0.2 corrupt=0.1 direction=2 window=8 queue=10"
+  "600 messages=2000 lambda=10 loss=0.1 corrupt=0.1 direction=2 sack=1 ackdelay=3 statinterval=100"
+  "700 messages=3000 lambda=2 loss=0.05 flows=8 bandwidth=20 linkqueue=30 cc=1 queue=50"
+  "900 messages=2000 lambda=5 loss=0.1 corrupt=0.1 direction=2 bidirectional=1 window=64 seqspace=256"
+  "500 messages=2000 lambda=10 lossmodel=gilbert loss=0.05 reorder=0.1 seqspace=64 checksum=crc32c"
+)
+
+# the CSV row without the columns that may differ
+row() {
+  "$@" trace=0 stats=csv </dev/null | awk -F, '
+    /^messages,/ { for (i = 1; i <= NF; i++) skip[i] = ($i == "peak_events" || $i == "allocations"); next }
+    NF > 40 { r = ""; for (i = 1; i <= NF; i++) if (!skip[i]) r = r $i ","; print r }'
+}
+
+for p in gbn sr; do
+  for s in "${scenarios[@]}"; do
+    t=${s%% *}
+    args="corrupt=0 direction=0 seed=9999 ${s#* }"
+    rm -f "$img"
+    ./$p $args trace=0 checkpoint="$img" checkpointat=$t </dev/null >/dev/null
+    full=$(row ./$p $args)
+    restored=$(row ./$p $args restore="$img")
+    if [ ! -s "$img" ] || [ -z "$full" ] || [ "$full" != "$restored" ]; then
+      echo "FAIL $p checkpointat=$t ${s#* }"
+      failed=1
+    else
+      echo "ok   $p checkpointat=$t ${s#* }"
+    fi
+  done
+done
+exit $failed
@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "emulator.h"
+#include "checksum.h"
+
+/* ******************************************************************
+   Checksum benchmark.
+
+   Times the checksums of checksum.c on buffers of 20 bytes (the
+   payload), 28 (a whole packet) and larger, and counts how many swapped
+   byte pairs and compensating errors each one misses.
+
+   usage: cksumbench [iterations per size, default 2000000]
+**********************************************************************/
+
+#define MAXLEN 65536
+#define NERRORS 100000
+#define PAYLOAD 20          /* the emulator's default payload= */
+#define PKTBYTES (offsetof(struct pkt, payload) + PAYLOAD)
+
+static unsigned char buf[MAXLEN];
+static volatile unsigned long sink;   /* keeps the results alive */
+
+static unsigned long rnd(void)
+{
+  static unsigned long x = 9999;
+
+  x = x * 6364136223846793005UL + 1442695040888963407UL;
+  return x >> 33;
+}
+
+static unsigned long fsum(const void *p, size_t n) { return (unsigned long)checksum_sum(p, n); }
+static unsigned long finet(const void *p, size_t n) { return checksum_inet(p, n); }
+static unsigned long fcrc(const void *p, size_t n) { return checksum_crc32c(p, n); }
+static unsigned long fcrcsw(const void *p, size_t n) { return checksum_crc32c_sw(p, n); }
+
+static const struct {
+  const char *name;
+  unsigned long (*f)(const void *, size_t);
+} algs[] = {
+  { "sum", fsum },
+  { "inet", finet },
+  { "crc32c-sw", fcrcsw },
+  { "crc32c", fcrc },
+};
+#define NALGS ((int)(sizeof(algs) / sizeof(algs[0])))
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* nanoseconds per call of f on len bytes */
+static double timeit(unsigned long (*f)(const void *, size_t), size_t len, long iters)
+{
+  unsigned long acc = 0;
+  double t;
+  long i;
+
+  t = now();
+  for (i = 0; i < iters; i++) {
+    buf[0] = (unsigned char)i;      /* a different buffer every time */
+    acc += f(buf, len);
+  }
+  t = now() - t;
+  sink = acc;
+  return t * 1e9 / iters;
+}
+
+/* errors in a packet that kind does not notice, out of NERRORS each */
+static void misses(int kind, const char *name)
+{
+  struct pkt p, q;
+  int i, j, k, swaps = 0, compensating = 0;
+
+  for (i = 0; i < NERRORS; i++) {
+    p.seqnum = (int)(rnd() % 16);
+    p.acknum = (int)(rnd() % 16);
+    for (j = 0; j < PAYLOAD; j++)
+      p.payload[j] = (char)('a' + rnd() % 26);
+    p.checksum = checksum_packet(kind, &p, PAYLOAD);
+
+    /* two different payload bytes swapped */
+    memcpy(&q, &p, PKTBYTES);
+    j = (int)(rnd() % PAYLOAD);
+    k = (int)(rnd() % (PAYLOAD - 1));
+    k += k >= j;
+    if (q.payload[j] == q.payload[k])
+      q.payload[k]++;
+    else {
+      q.payload[j] = p.payload[k];
+      q.payload[k] = p.payload[j];
+    }
+    q.checksum = p.checksum;
+    swaps += checksum_packet(kind, &q, PAYLOAD) == q.checksum;
+
+    /* one byte up and another one down by the same amount */
+    memcpy(&q, &p, PKTBYTES);
+    q.payload[j] += 3;
+    q.payload[k] -= 3;
+    compensating += checksum_packet(kind, &q, PAYLOAD) == q.checksum;
+  }
+  printf("%-10s missed %6d swaps and %6d compensating errors of %d\n", name, swaps, compensating, NERRORS);
+}
+
+int main(int argc, char **argv)
+{
+  static const size_t lens[] = { 20, 28, 256, 1500, MAXLEN };
+  long iters = argc > 1 ? atol(argv[1]) : 2000000;
+  long n;
+  size_t i;
+  int a;
+
+  if (iters <= 0) {
+    printf("usage: %s [iterations per size]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < MAXLEN; i++)
+    buf[i] = (unsigned char)rnd();
+
+  printf("crc32c uses %s\n\n", checksum_crc32c_impl());
+  printf("   bytes");
+  for (a = 0; a < NALGS; a++)
+    printf("  %10s ns   GB/s", algs[a].name);
+  printf("\n");
+  for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+    /* about the same number of bytes for every size */
+    n = (long)(iters * 28.0 / lens[i]);
+    if (n < 100)
+      n = 100;
+    printf("%8lu", (unsigned long)lens[i]);
+    for (a = 0; a < NALGS; a++) {
+      double ns = timeit(algs[a].f, lens[i], n);
+      printf("  %13.2f %6.2f", ns, lens[i] / ns);
+    }
+    printf("\n");
+  }
+
+  printf("\n");
+  misses(CHECKSUM_SUM, "sum");
+  misses(CHECKSUM_INET, "inet");
+  misses(CHECKSUM_CRC32C, "crc32c");
+  return 0;
+}
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200112L   /* clock_gettime() */
 /* ***** THIS FILE SHOULD NOT BE MODIFIED ****************************
    THERE IS NOT REASON THAT ANY STUDENT SHOULD HAVE TO READ OR UNDERSTAND
    THE CODE BELOW.  YOU SHOLD NOT TOUCH, OR REFERENCE (in your code) ANY
@@ -25,239 +26,1829 @@
    - packets will be delivered in the order in which they were sent
    (although some can be lost).
 
-   Modifications (6/6/2008 - CLP): 
-   - removed bidirectional GBN code and other code not used by prac. 
+   Modifications (6/6/2008 - CLP):
+   - removed bidirectional GBN code and other code not used by prac.
    - removed hard coded maximum random number, use library defined
-   RAND_MAX value 
+   RAND_MAX value
    - simulator stops when no events are left rather than stopping as
    soon as n packets are sent.
    - fixed C style to adhere to current programming style
 
+   Modifications:
+   - pending events are kept in a binary heap, timers and the channel
+   tail are tracked directly, events come from a slab pool
+   - timers wait in a hashed timing wheel next to the heap, so starting,
+   stopping and expiring one takes constant time whatever the number of
+   flows and packets.  Both are merged in (evtime, evseq) order
+   - the results count the events dispatched and the memory allocations
+   of the run, bench.c turns them into events per second and allocations
+   per event
+   - the clock, event times and get_sim_time() are doubles: a float
+   cannot tell events one time unit apart once the clock is past 2^24,
+   a double keeps them exact for runs of 1e8 messages and more.  So are
+   all the real-valued parameters, the times such as lambda=,
+   reorderdelay=, statinterval=, checkpointat= and snapshot= as well as
+   the probabilities
+   - checkpoint=FILE checkpointat=T saves the whole simulation, events,
+   random streams, counters and the protocols' state, when the clock
+   passes T.  restore=FILE continues it, so long warm-ups are run once
+   and each branch sets its own parameters.  The protocols register the
+   pointers into their protocol_alloc() blocks with protocol_pointer(),
+   so they can be moved to the restored blocks.  ckptcheck.sh checks that
+   restored runs end like uninterrupted ones
+   - rand() replaced by seedable xoshiro256** generators, one stream per
+   random process so results are identical on every platform
+   - parameters can be given as key=value arguments or in a config file,
+   the prompts are only used for values that were not given
+   - all emulator and protocol state lives in a struct sim, so several
+   simulations can run in one process (one per thread at a time).
+   main() is in main.c, the parameter sweep driver in sweep.c
+   - with -DTRACE_LEVEL=n the trace level is a compile time constant,
+   trace output is printed a line at a time into a large stdout buffer
+   - evlog=FILE records every event in a compact binary file (evtrace.h)
+   that evreplay analyses offline
+   - the delay from A_output() to tolayer5() of every message goes into a
+   log-linear histogram, the report gives its percentiles, the goodput and
+   the channel utilisation (statinterval=T adds a table per T time units)
+   - get_sim_time() lets a protocol run several logical timers on top of
+   the one real timer per entity
+   - protocols can read their own integer parameters (protocol_option())
+   and allocate buffers that are freed with the simulation (protocol_alloc())
+   - the report includes the protocols' sender queue (queue=N) statistics
+   and the number of ACKs sent
+   - bidirectional=1 generates messages at B as well, BIDIRECTIONAL is
+   only the default
+   - payload=N sets the message and packet size (at most MAXPAYLOAD).
+   Packets and messages are passed by pointer, a packet in the channel
+   is kept in a buffer of just its size that stays with its event
+   - bandwidth=, propdelay=, jitter= and linkqueue= replace the delay of
+   1 to 10 time units after the previous arrival with a link model: the
+   packet waits in a finite FIFO, takes its size / bandwidth to send and
+   arrives propdelay plus jitter later.  The queue drops at the tail or,
+   with aqm=red, early (RED).  _ab and _ba set one direction only
+   - protocols with congestion control report their window with
+   protocol_cwnd(), for the event trace and the statinterval= table
+   - lossmodel=gilbert loses packets in bursts (Gilbert-Elliott): each
+   channel is in a good or a bad state, bad periods last burst= packets on
+   average and the mean loss is still loss=.  lossmodel=trace takes the
+   losses from a file of 0s and 1s (losstrace=FILE)
+   - flows=N runs N pairs of A and B side by side over the same channels.
+   Each flow has its own protocol state, timers, arrivals (one message per
+   lambda on average) and statistics, events carry their flow.  The
+   report adds a table of the flows and Jain's fairness index
+   - reorder=P holds a packet up for up to reorderdelay= time units
+   without holding up the packets behind it, so they can overtake it.
+   A late copy can then alias a sequence number that has been reused, so
+   the protocols need more sequence numbers than their minimum
+   - snapshot=T or snapshotms=X print a JSON line of throughput, packets
+   in flight, resend rate, queue depth and events per second every T time
+   units or X ms of wall-clock time.  The run publishes its counters
+   every 1024 events, sim_snapshot() reads them from another thread
+   through a sequence word without locking the run.  gbn and sr print
+   the snapshotms= lines from such a thread
+
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "emulator.h"
 #include "gbn.h"
+#include "sim.h"
+#include "evtrace.h"
+
+/* thread local storage for the simulation run by the current thread */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define SIM_TLS _Thread_local
+#else
+#define SIM_TLS __thread
+#endif
+
+/* the words of the snapshot lock: C11 atomics, else the GCC builtins */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_ulong snapword_t;
+#define SEQ_LOAD(p, order)     atomic_load_explicit(p, memory_order_##order)
+#define SEQ_STORE(p, v, order) atomic_store_explicit(p, v, memory_order_##order)
+#define SEQ_FENCE(order)       atomic_thread_fence(memory_order_##order)
+#else
+typedef unsigned long snapword_t;
+#define SEQ_ATOMIC_relaxed __ATOMIC_RELAXED
+#define SEQ_ATOMIC_acquire __ATOMIC_ACQUIRE
+#define SEQ_ATOMIC_release __ATOMIC_RELEASE
+#define SEQ_LOAD(p, order)     __atomic_load_n(p, SEQ_ATOMIC_##order)
+#define SEQ_STORE(p, v, order) __atomic_store_n(p, v, SEQ_ATOMIC_##order)
+#define SEQ_FENCE(order)       __atomic_thread_fence(SEQ_ATOMIC_##order)
+#endif
+#define SNAPWORDS ((sizeof(struct sim_snapshot) + sizeof(unsigned long) - 1) / sizeof(unsigned long))
+#define SNAP_EVENTS 1024        /* events between publications, a power of 2 */
 
 struct event {
-  float evtime;           /* event time */
+  double evtime;          /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
+  int flow;               /* and the flow it belongs to */
+  struct pkt *pkt;        /* copy of the packet (if any) assoc w/ this event */
+  unsigned long evseq;    /* insertion order, breaks ties on equal evtime */
+  struct event *nextfree; /* link in the free list while the event is unused */
+  struct event *next, *prev; /* timers: the list of their wheel slot */
+  long tick;              /* timers: the wheel tick evtime falls in */
 };
 
-struct event *evlist = NULL;   /* the event list */
-
 /* possible events: */
-#define  TIMER_INTERRUPT 0  
+#define  TIMER_INTERRUPT 0
 #define  FROM_LAYER5     1
 #define  FROM_LAYER3     2
 
+#define  PAYLOAD         20  /* default payload size, as in the original emulator */
+
+/* bytes of a packet that has a payload of s->payloadsize bytes */
+#define  PKTBYTES(s)     (offsetof(struct pkt, payload) + (size_t)(s)->payloadsize)
+/* bytes of data shown in trace lines, the data has no terminating '\0' */
+#define  TRACEBYTES(s)   ((s)->payloadsize < 20 ? (s)->payloadsize : 20)
+
 #define  OFF             0
 #define  ON              1
 
+/* events are carved out of slabs and recycled through a free list, so the */
+/* steady state main loop does not call malloc() or free().  The packet     */
+/* buffer of an event is allocated the first time it carries a packet and  */
+/* is kept while the event is recycled.                                    */
+#define EVENTS_PER_SLAB 256
+struct evslab {
+  struct evslab *next;
+  struct event events[EVENTS_PER_SLAB];
+};
+
+/* running timers are hashed by their tick, floor(evtime * WHEELRES),   */
+/* into one of WHEELSLOTS lists, a list holds timers of later turns of  */
+/* the wheel too.  The cursor only moves over ticks without timers, so  */
+/* no timer is ever due before it.  Ticks are short so that the timers */
+/* of many flows rarely share one                                      */
+#define WHEELRES    16      /* ticks per time unit */
+#define WHEELSLOTS  4096    /* a power of two */
+
+/* random number streams.  Loss, corruption, delay and message arrivals  */
+/* each draw from their own generator, so changing one probability does   */
+/* not perturb the random sequence seen by the others                     */
+#define RNG_LOSS     0
+#define RNG_CORRUPT  1
+#define RNG_DELAY    2
+#define RNG_ARRIVAL  3
+#define RNG_LINK     4   /* RED's early drops */
+#define RNG_REORDER  5
+#define NRNGSTREAMS  6
+
+#define DEFAULT_SEED 9999
+
+/* run parameters, see sim_set() */
+#define MAXOPTIONS   64
+#define MAXOPTKEY    32
+#define MAXOPTVALUE  256
+
+struct option {
+  char key[MAXOPTKEY];
+  char value[MAXOPTVALUE];
+  int used;                /* set once the parameter has been looked up */
+};
+
+/* header in front of every protocol_alloc() block, keeps the data aligned */
+union protoblock {
+  struct {
+    union protoblock *next;
+    size_t size;             /* bytes of data after the header */
+  } h;
+  long double align1;
+  long long align2;
+  void *align3;
+};
+
+#define MAXPROTOPOINTERS 64  /* pointer fields protocol_pointer() can register */
+
+#define EVLOG_RECORDS 4096   /* binary trace records buffered before a write */
+
+/* message latency histogram: latencies are counted in units of 1/LAT_SCALE,
+   values below LAT_SUB are exact, above that every power of two is split
+   into LAT_SUB buckets, so a bucket is never more than 1/LAT_SUB wide
+   relative to its value */
+#define LAT_SCALE    1000.0
+#define LAT_SUBBITS  5
+#define LAT_SUB      (1 << LAT_SUBBITS)
+#define LAT_BUCKETS  ((32 - LAT_SUBBITS + 1) * LAT_SUB)
+
+/* counters of one statinterval= window */
+struct statwindow {
+  int accepted;                 /* messages taken by A_output()/B_output() */
+  int delivered;                /* messages given to tolayer5() */
+  double latencysum;            /* summed latency of the delivered ones */
+  int sent;                     /* packets given to tolayer3() */
+  double busy[2];               /* time the channel towards A and B was in use */
+  float cwnd[2];                /* congestion window of A and B at the end, 0 if unchanged */
+};
+
+/* the link model, used if bandwidth= or propdelay= is given for a link */
+#define JITTER_UNIFORM     0   /* uniform on [0, 2 * jitter] */
+#define JITTER_EXPONENTIAL 1
+#define AQM_DROPTAIL 0
+#define AQM_RED      1
+#define RED_WEIGHT   0.002     /* weight of the current queue in RED's average */
+#define RED_MAXP     0.1       /* RED's drop probability when the average reaches redmax */
+
+struct link {
+  /* parameters */
+  double bandwidth;             /* bytes per time unit, 0 = packets take no time to send */
+  double propdelay;             /* fixed delay once the packet has been sent */
+  double jitter;                /* mean extra delay, from jitterdist */
+  int jitterdist;               /* JITTER_UNIFORM or JITTER_EXPONENTIAL */
+  int limit;                    /* packets queued, the one being sent included, 0 = no limit */
+  int aqm;                      /* AQM_DROPTAIL or AQM_RED */
+  double redmin, redmax;        /* RED's thresholds for the average queue */
+
+  /* state */
+  double linkfree;              /* when the last queued packet has been sent */
+  double redavg;                /* RED's average queue length */
+  int redcount;                 /* packets since the last early drop, -1 below redmin */
+};
+
+/* loss models, lossmodel= */
+#define LOSS_BERNOULLI 0   /* every packet is lost with probability loss */
+#define LOSS_GILBERT   1   /* two states with their own loss probability */
+#define LOSS_TRACE     2   /* packet n is lost if character n of the trace is 1 */
+
+#define BURST          4.0    /* default mean length of a bad period, in packets */
+#define REORDERDELAY   10.0   /* default longest hold up of a reordered packet */
+
+#define MAXFLOWS       65535  /* the flow of an evlog= record has 16 bits */
+
+/* one pair of A and B, the flows share the channels */
+struct flow {
+  void *proto;                  /* the protocol's own state, protocol_state_size bytes */
+  struct protocol_stats pstats; /* statistics updated by the protocol */
+  struct event *timerevent[2];  /* outstanding timer event of A and B, or NULL */
+  float cwnd[2];                /* the latest congestion window of A and B */
+
+  /* message latency, messages are delivered in the order they were accepted
+     so the acceptance times wait in a ring per sending entity */
+  double *accepttimes[2];       /* ring buffers, maxaccepted[] entries */
+  int acceptfirst[2];           /* oldest undelivered message */
+  int naccepted[2];             /* messages waiting for delivery */
+  int maxaccepted[2];
+  int delivered;                /* messages given to tolayer5() */
+  double latencysum;            /* summed latency of the delivered ones */
+};
+
+#define STATS_NONE 0
+#define STATS_CSV  1
+#define STATS_JSON 2
+
+/* everything one simulation needs */
+struct sim {
+  /* the pending events are kept in a binary min-heap ordered by (evtime, evseq) */
+  struct event **evheap;        /* heap array, evheap[0] is the next event */
+  int nevents;                  /* number of events in the heap */
+  int maxevents;                /* allocated size of evheap */
+  unsigned long nextevseq;      /* sequence number for the next inserted event */
+  struct event *wheel[WHEELSLOTS];  /* the running timers, see WHEELRES */
+  long wheelcursor;             /* no timer is due before this tick */
+  int ntimers;                  /* number of timers in the wheel */
+  struct event *nexttimer;      /* the earliest timer, NULL if not known */
+  double channeltail[2];        /* latest scheduled packet arrival time at A and B */
+  int gebad[2];                 /* the Gilbert-Elliott state of the channels, 1 = bad */
+  size_t tracepos[2];           /* next character of the loss trace for each channel */
+  int lastlost[2];              /* was the last packet on the channel lost? */
+  int linkmodel;                /* are the links below used instead of the original delay? */
+  struct link link[2];          /* the links towards A and B */
+
+  /* event pool */
+  struct evslab *evslabs;       /* all slabs allocated so far */
+  struct event *freeevents;     /* unused events */
+  int eventsinuse;              /* events currently handed out */
+  int peakevents;               /* high water mark of eventsinuse */
+  int nslabs;                   /* number of slabs allocated */
+  long ndispatched;             /* events dispatched by sim_run() */
+  int nallocs;                  /* malloc() and friends called during the run */
+
+  /* the flows, the student routines act on flows[flow] */
+  struct flow *flows;
+  int nflows;
+  int flow;
+  union protoblock *protoblocks;  /* buffers from protocol_alloc(), of every flow */
+  size_t protopointers[MAXPROTOPOINTERS];   /* offsets of the pointers into them */
+  int nprotopointers;           /* in the protocol state, see protocol_pointer() */
+
+  /* statistics updated by the protocol, the sum of the flows' at the end */
+  struct protocol_stats pstats;
+
+  /* statistics updated by emulator */
+  int messages_delivered;
+  int nsim;                     /* number of messages from 5 to 4 so far */
+  int ntolayer3;                /* number sent into layer 3 */
+  int nlost;                    /* number lost in media */
+  int ncorrupt;                 /* number corrupted by media*/
+  int nlinkdrops;               /* number dropped by a link queue, RED's included */
+  int nreddrops;                /* number dropped early by RED */
+  int nlossbursts;              /* runs of packets lost in a row on one channel */
+  int nreordered;               /* number held up by reorder= */
+  int cwndreported;             /* has the protocol reported a congestion window? */
+  float cwnd[2];                /* the latest congestion window of A and B, summed over the flows */
+
+  /* message latency of all flows */
+  uint32_t latcounts[LAT_BUCKETS];
+  int nlatencies;
+  double latencysum;
+  double latencymax;
+  double busy[2];               /* time the channel towards A and B was in use */
+
+  /* per window statistics, statinterval > 0 */
+  double statinterval;
+  struct statwindow *windows;
+  int nwindows;                 /* windows used so far */
+  int maxwindows;               /* allocated size of windows */
+
+  /* parameters */
+  int nsimmax;                  /* number of msgs to generate, then stop */
+  double time;                  /* the simulation clock */
+  double lossprob;              /* probability that a packet is dropped  */
+  double corruptprob;           /* probability that one bit is packet is flipped */
+  int lossmodel;                /* LOSS_BERNOULLI, LOSS_GILBERT or LOSS_TRACE */
+  double burst;                 /* Gilbert-Elliott: mean packets in the bad state */
+  double lossgood, lossbad;     /* and the loss probability in either state */
+  double gep, ger;              /* chance to go from good to bad and back, per packet */
+  char *losstrace;              /* LOSS_TRACE: 0 or 1 for each packet, repeated */
+  size_t losstracelen;
+  double reorder;               /* probability that a packet is held up */
+  double reorderdelay;          /* for up to this long */
+  int corruptdirection;         /* A->B A<-B or bidirectional corruption/loss */
+  int bidirectional;            /* do messages arrive at B too? */
+  int payloadsize;              /* bytes of data in a message or packet */
+  double lambda;                /* arrival rate of messages from layer 5 */
+  unsigned long seed;           /* seed for all random streams */
+  uint64_t rngstate[NRNGSTREAMS][4];   /* xoshiro256** state of each stream */
+
+  struct option options[MAXOPTIONS];
+  int noptions;
+  int statsformat;              /* STATS_NONE, STATS_CSV or STATS_JSON */
+  const char *statsfilename;    /* append the stats there instead of stdout */
+  const char *checkpointfile;   /* save the state there ... */
+  double checkpointat;          /* ... at this time and stop */
+  const char *restorefile;      /* continue the run saved there */
+
+  /* live snapshots */
+  double snapinterval;          /* time units between printed snapshots, 0 = off */
+  double snapms;                /* main.c prints one every snapms of wall-clock time */
+  FILE *snapfile;               /* NULL: stdout */
+  double nextsnap;              /* time of the next snapshot */
+  double wallstart;             /* wall-clock time sim_run() started */
+  int inflight;                 /* FROM_LAYER3 events pending */
+  snapword_t snapseq;           /* odd while snap is being written, 0 = none yet */
+  snapword_t snap[SNAPWORDS];   /* the counters published for sim_snapshot() */
+  struct sim_snapshot lastsnap; /* the snapshot printed last, rates are since then */
+
+  /* binary event trace */
+  FILE *evlog;                  /* NULL unless evlog=FILE was given */
+  struct evrecord *evbuf;       /* records not yet written */
+  int nevbuf;
+};
+
+#ifndef TRACE_LEVEL
 int TRACE = 3;
+#endif
 
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;            /* probability that a packet is dropped  */
-static float corruptprob;   /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+static SIM_TLS struct sim *sim;   /* simulation the student routines act on */
+
+static uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* expand the seed into an independent state for every stream */
+static void seedrandom(struct sim *s)
+{
+  uint64_t x;
+  int i, j;
+
+  for (i = 0; i < NRNGSTREAMS; i++) {
+    x = (uint64_t)s->seed ^ ((uint64_t)(i+1) << 56);
+    for (j = 0; j < 4; j++)
+      s->rngstate[i][j] = splitmix64(&x);
+  }
+}
+
+static uint64_t rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
 
 /****************************************************************************/
-/* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* jimsrand(): return a double in range [0,1) from the given stream.  The   */
+/* routine below is used to isolate all random number generation in one    */
+/* location.  xoshiro256** is used instead of rand() so that a seed gives   */
+/* the same run on every machine.                                           */
 /****************************************************************************/
-double jimsrand(void) 
+static double jimsrand(struct sim *s, int stream)
+{
+  uint64_t *st = s->rngstate[stream];
+  uint64_t result = rotl(st[1] * 5, 7) * 9;
+  uint64_t t = st[1] << 17;
+
+  st[2] ^= st[0];
+  st[3] ^= st[1];
+  st[1] ^= st[2];
+  st[0] ^= st[3];
+  st[2] ^= t;
+  st[3] = rotl(st[3], 45);
+
+  return (result >> 11) * (1.0 / 9007199254740992.0);   /* top 53 bits / 2^53 */
+}
+
+/********************* BINARY EVENT TRACE ************/
+/* Records go to a buffer that is written out in      */
+/* blocks of EVLOG_RECORDS, see evtrace.h for layout  */
+/*****************************************************/
+
+static void evlog_open(struct sim *s, const char *filename)
+{
+  struct evheader h;
+
+  if ((s->evlog = fopen(filename, "wb")) == NULL) {
+    printf("unable to open event log %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  s->evbuf = malloc(EVLOG_RECORDS * sizeof(struct evrecord));
+  if (s->evbuf == 0) {
+    printf("memory allocation for event log failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->nevbuf = 0;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, EVTRACE_MAGIC, sizeof(h.magic));
+  h.version = EVTRACE_VERSION;
+  h.recsize = sizeof(struct evrecord);
+  fwrite(&h, sizeof(h), 1, s->evlog);
+}
+
+static void evlog_flush(struct sim *s)
+{
+  if (s->nevbuf > 0 && fwrite(s->evbuf, sizeof(struct evrecord), s->nevbuf, s->evlog) != (size_t)s->nevbuf) {
+    printf("write to event log failed\n");
+    exit(EXIT_FAILURE);
+  }
+  s->nevbuf = 0;
+}
+
+static void evlog_close(struct sim *s)
+{
+  evlog_flush(s);
+  fclose(s->evlog);
+  free(s->evbuf);
+  s->evlog = NULL;
+  s->evbuf = NULL;
+}
+
+static uint32_t datahash(const struct sim *s, const char *data)
+{
+  uint32_t h = 2166136261u;   /* FNV-1a */
+  int i;
+
+  for (i = 0; i < s->payloadsize; i++)
+    h = (h ^ (unsigned char)data[i]) * 16777619u;
+  return h;
+}
+
+/* append a record, the caller fills in the type specific fields */
+static struct evrecord *evlog_record(struct sim *s, int type, int entity)
+{
+  struct evrecord *r;
+
+  if (s->nevbuf == EVLOG_RECORDS)
+    evlog_flush(s);
+  r = &s->evbuf[s->nevbuf++];
+  memset(r, 0, sizeof(*r));
+  r->time = s->time;
+  r->type = (uint8_t)type;
+  r->entity = (uint8_t)entity;
+  r->flow = (uint16_t)s->flow;
+  return r;
+}
+
+/********************* LATENCY AND CHANNEL STATISTICS */
+/* No printing while the simulation runs: counters   */
+/* only, sim_report() turns them into percentiles    */
+/*****************************************************/
+
+static int latbucket(double latency)
+{
+  double scaled = latency * LAT_SCALE;
+  uint32_t v = scaled >= 4294967295.0 ? 4294967295u : (uint32_t)scaled;
+  int shift = 0;
+
+  if (v < LAT_SUB)
+    return (int)v;
+  while ((v >> shift) >= 2 * LAT_SUB)
+    shift++;
+  return shift * LAT_SUB + (int)(v >> shift);
+}
+
+/* middle of a histogram bucket, in time units */
+static double latvalue(int bucket)
+{
+  int shift;
+
+  if (bucket < LAT_SUB)
+    return (bucket + 0.5) / LAT_SCALE;
+  shift = bucket / LAT_SUB - 1;
+  return (((double)(bucket % LAT_SUB + LAT_SUB) + 0.5) * (double)(1UL << shift)) / LAT_SCALE;
+}
+
+/* latency below which the fraction p of the delivered messages lie */
+static double latpercentile(struct sim *s, double p)
+{
+  double rank = p * s->nlatencies, v;
+  long seen = 0;
+  int i;
+
+  if (s->nlatencies == 0)
+    return 0.0;
+  for (i = 0; i < LAT_BUCKETS; i++) {
+    seen += s->latcounts[i];
+    if (seen >= rank && seen > 0) {
+      v = latvalue(i);
+      return v < s->latencymax ? v : s->latencymax;
+    }
+  }
+  return s->latencymax;
+}
+
+/* the window that time t falls in, created when first needed */
+static struct statwindow *getwindow(struct sim *s, double t)
+{
+  int w = (int)(t / s->statinterval);
+
+  if (w >= s->maxwindows) {
+    int newmax = s->maxwindows ? 2 * s->maxwindows : 64;
+
+    while (newmax <= w)
+      newmax *= 2;
+    s->windows = realloc(s->windows, newmax * sizeof(struct statwindow));
+    s->nallocs++;
+    if (s->windows == 0) {
+      printf("memory allocation for statistics windows failed.");
+      exit(EXIT_FAILURE);
+    }
+    memset(s->windows + s->maxwindows, 0, (newmax - s->maxwindows) * sizeof(struct statwindow));
+    s->maxwindows = newmax;
+  }
+  if (w >= s->nwindows)
+    s->nwindows = w + 1;
+  return &s->windows[w];
+}
+
+/* AorB took a message at the current time */
+static void messageaccepted(struct sim *s, struct flow *f, int AorB)
+{
+  int i;
+
+  if (f->naccepted[AorB] == f->maxaccepted[AorB]) {
+    int newmax = f->maxaccepted[AorB] ? 2 * f->maxaccepted[AorB] : 64;
+    double *ring = malloc(newmax * sizeof(double));
+
+    s->nallocs++;
+    if (ring == 0) {
+      printf("memory allocation for latency ring failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < f->naccepted[AorB]; i++)
+      ring[i] = f->accepttimes[AorB][(f->acceptfirst[AorB] + i) % f->maxaccepted[AorB]];
+    free(f->accepttimes[AorB]);
+    f->accepttimes[AorB] = ring;
+    f->acceptfirst[AorB] = 0;
+    f->maxaccepted[AorB] = newmax;
+  }
+  i = (f->acceptfirst[AorB] + f->naccepted[AorB]) % f->maxaccepted[AorB];
+  f->accepttimes[AorB][i] = s->time;
+  f->naccepted[AorB]++;
+  if (s->statinterval > 0)
+    getwindow(s, s->time)->accepted++;
+}
+
+/* the oldest message accepted by AorB of flow f reached the other side */
+static void messagedelivered(struct sim *s, struct flow *f, int AorB)
+{
+  double latency;
+
+  if (f->naccepted[AorB] == 0)
+    return;        /* protocol delivered more than it accepted */
+  latency = s->time - f->accepttimes[AorB][f->acceptfirst[AorB]];
+  f->acceptfirst[AorB] = (f->acceptfirst[AorB] + 1) % f->maxaccepted[AorB];
+  f->naccepted[AorB]--;
+  f->delivered++;
+  f->latencysum += latency;
+
+  s->latcounts[latbucket(latency)]++;
+  s->nlatencies++;
+  s->latencysum += latency;
+  if (latency > s->latencymax)
+    s->latencymax = latency;
+  if (s->statinterval > 0) {
+    struct statwindow *w = getwindow(s, s->time);
+
+    w->delivered++;
+    w->latencysum += latency;
+  }
+}
+
+/* the channel towards AorB carries a packet from..to */
+static void channelbusy(struct sim *s, int AorB, double from, double to)
+{
+  double end;
+
+  s->busy[AorB] += to - from;
+  if (s->statinterval <= 0)
+    return;
+  getwindow(s, from)->sent++;
+  while (from < to) {       /* split the interval at window boundaries */
+    end = ((int)(from / s->statinterval) + 1) * s->statinterval;
+    if (end > to)
+      end = to;
+    getwindow(s, from)->busy[AorB] += end - from;
+    from = end;
+  }
+}
+
+/* Random Early Detection (Floyd and Jacobson, 1993): a packet that finds
+   q packets in the queue is dropped with a probability that grows with
+   the average queue length, spread out by redcount */
+static int reddrop(struct sim *s, struct link *l, int q, double txtime)
 {
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
-  double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
-  if (TRACE > 3)
-    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
-  return(x);
-}  
+  double pb;
+
+  if (q > 0)
+    l->redavg += RED_WEIGHT * (q - l->redavg);
+  else if (txtime > 0)   /* idle since linkfree, as if small packets had found it empty */
+    l->redavg *= pow(1.0 - RED_WEIGHT, floor((s->time - l->linkfree) / txtime));
+  if (l->redavg < l->redmin) {
+    l->redcount = -1;
+    return 0;
+  }
+  if (l->redavg >= l->redmax) {
+    l->redcount = 0;
+    return 1;
+  }
+  l->redcount++;
+  pb = RED_MAXP * (l->redavg - l->redmin) / (l->redmax - l->redmin);
+  if (l->redcount * pb >= 1.0 || jimsrand(s, RNG_LINK) < pb / (1.0 - l->redcount * pb)) {
+    l->redcount = 0;
+    return 1;
+  }
+  return 0;
+}
+
+/* queue a packet for the link towards AorB.  Returns 0 if the queue
+   drops it, else sets *sent to when the packet has left the sender */
+static int linksend(struct sim *s, int AorB, double *sent)
+{
+  struct link *l = &s->link[AorB];
+  double now = s->time;
+  double txtime = l->bandwidth > 0 ? PKTBYTES(s) / l->bandwidth : 0.0;
+  double start = l->linkfree > now ? l->linkfree : now;
+  int q = 0;
+
+  /* every packet has the same size, so the backlog says how many wait */
+  if (txtime > 0 && l->linkfree > now)
+    q = (int)ceil((l->linkfree - now) / txtime - 1e-9);
+  if (l->aqm == AQM_RED && reddrop(s, l, q, txtime)) {
+    s->nreddrops++;
+    s->nlinkdrops++;
+    return 0;
+  }
+  if (l->limit > 0 && q >= l->limit) {
+    s->nlinkdrops++;
+    return 0;
+  }
+  *sent = start + txtime;
+  l->linkfree = *sent;
+  channelbusy(s, AorB, start, *sent);
+  return 1;
+}
+
+/* when a packet sent at time sent arrives at AorB */
+static double linkarrival(struct sim *s, int AorB, double sent)
+{
+  struct link *l = &s->link[AorB];
+  double arrival = sent + l->propdelay;
+
+  if (l->jitter > 0) {
+    if (l->jitterdist == JITTER_EXPONENTIAL)
+      arrival -= l->jitter * log(1.0 - jimsrand(s, RNG_DELAY));
+    else
+      arrival += 2 * l->jitter * jimsrand(s, RNG_DELAY);
+  }
+  /* the link does not reorder, jitter cannot take a packet past the one before */
+  if (arrival < s->channeltail[AorB])
+    arrival = s->channeltail[AorB];
+  return arrival;
+}
+
+/* does the loss model lose the next packet on the channel towards AorB?
+   Every packet draws the same random numbers whether or not losses apply
+   to its direction, as with the original single draw */
+static int lossdraw(struct sim *s, int AorB)
+{
+  double p;
+  int lost;
+
+  switch (s->lossmodel) {
+  case LOSS_GILBERT:
+    p = s->gebad[AorB] ? s->lossbad : s->lossgood;
+    lost = p >= 1.0 || (p > 0.0 && jimsrand(s, RNG_LOSS) < p);
+    if (jimsrand(s, RNG_LOSS) < (s->gebad[AorB] ? s->ger : s->gep))
+      s->gebad[AorB] = !s->gebad[AorB];
+    return lost;
+  case LOSS_TRACE:
+    lost = s->losstrace[s->tracepos[AorB]];
+    s->tracepos[AorB] = (s->tracepos[AorB] + 1) % s->losstracelen;
+    return lost;
+  default:
+    return jimsrand(s, RNG_LOSS) < s->lossprob;
+  }
+}
 
 /********************* EVENT HANDLINE ROUTINES *******/
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p)
+static struct event *newevent(struct sim *s)
+{
+  struct evslab *slab;
+  struct event *p;
+  int i;
+
+  if (s->freeevents == NULL) {   /* pool is empty, add another slab */
+    slab = malloc(sizeof(struct evslab));
+    s->nallocs++;
+    if (slab == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    slab->next = s->evslabs;
+    s->evslabs = slab;
+    s->nslabs++;
+    for (i = EVENTS_PER_SLAB-1; i >= 0; i--) {
+      slab->events[i].pkt = NULL;
+      slab->events[i].nextfree = s->freeevents;
+      s->freeevents = &slab->events[i];
+    }
+  }
+  p = s->freeevents;
+  s->freeevents = p->nextfree;
+  if (++s->eventsinuse > s->peakevents)
+    s->peakevents = s->eventsinuse;
+  return p;
+}
+
+static void freeevent(struct sim *s, struct event *p)
+{
+  p->nextfree = s->freeevents;
+  s->freeevents = p;
+  s->eventsinuse--;
+}
+
+static void freeeventpool(struct sim *s)
 {
-  struct event *q,*qold;
+  struct evslab *slab;
+  int i;
+
+  while ((slab = s->evslabs) != NULL) {
+    s->evslabs = slab->next;
+    for (i = 0; i < EVENTS_PER_SLAB; i++)
+      free(slab->events[i].pkt);
+    free(slab);
+  }
+  s->freeevents = NULL;
+}
+
+/* true if event p must be dispatched before event q */
+static int earlier(const struct event *p, const struct event *q)
+{
+  if (p->evtime != q->evtime)
+    return p->evtime < q->evtime;
+  return p->evseq < q->evseq;     /* equal times are dispatched first in, first out */
+}
+
+static void siftup(struct sim *s, int i)
+{
+  struct event **evheap = s->evheap;
+  struct event *p = evheap[i];
+  int parent;
+
+  while (i > 0) {
+    parent = (i-1)/2;
+    if (!earlier(p, evheap[parent]))
+      break;
+    evheap[i] = evheap[parent];
+    i = parent;
+  }
+  evheap[i] = p;
+}
+
+static void siftdown(struct sim *s, int i)
+{
+  struct event **evheap = s->evheap;
+  struct event *p = evheap[i];
+  int child;
 
+  while ((child = 2*i+1) < s->nevents) {
+    if (child+1 < s->nevents && earlier(evheap[child+1], evheap[child]))
+      child++;
+    if (!earlier(evheap[child], p))
+      break;
+    evheap[i] = evheap[child];
+    i = child;
+  }
+  evheap[i] = p;
+}
+
+/* add p to the heap, its evseq is set */
+static void pushevent(struct sim *s, struct event *p)
+{
+  struct event **newheap;
+
+  if (s->nevents == s->maxevents) {   /* heap is full, double its size */
+    s->maxevents = s->maxevents ? 2*s->maxevents : 64;
+    newheap = realloc(s->evheap, s->maxevents * sizeof(struct event *));
+    s->nallocs++;
+    if (newheap == 0) {
+      printf("memory allocation for event list failed.");
+      exit(EXIT_FAILURE);
+    }
+    s->evheap = newheap;
+  }
+  s->evheap[s->nevents++] = p;
+  siftup(s, s->nevents-1);
+}
+
+static void insertevent(struct sim *s, struct event *p)
+{
   if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+    printf("            INSERTEVENT: time is %f\n",s->time);
+    printf("            INSERTEVENT: future time will be %f\n",p->evtime);
   }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
+  p->evseq = s->nextevseq++;
+  pushevent(s, p);
+}
+
+/* remove the event at heap position i and return it */
+static struct event *removeevent(struct sim *s, int i)
+{
+  struct event *p = s->evheap[i];
+
+  s->nevents--;
+  if (i < s->nevents) {   /* move the last event into the hole and restore the heap */
+    s->evheap[i] = s->evheap[s->nevents];
+    if (i > 0 && earlier(s->evheap[i], s->evheap[(i-1)/2]))
+      siftup(s, i);
+    else
+      siftdown(s, i);
   }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
+  return p;
+}
+
+static long wheeltick(double t)
+{
+  return (long)floor(t * WHEELRES);
+}
+
+/* add timer p to the wheel in O(1), its evseq is set */
+static void linktimer(struct sim *s, struct event *p)
+{
+  struct event **slot;
+
+  p->tick = wheeltick(p->evtime);
+  if (s->ntimers == 0 || p->tick < s->wheelcursor) {
+    s->wheelcursor = p->tick;     /* the cursor may have moved past its tick */
+    s->nexttimer = p;
+  }
+  else if (s->nexttimer != NULL && earlier(p, s->nexttimer))
+    s->nexttimer = p;
+  slot = &s->wheel[p->tick & (WHEELSLOTS-1)];
+  p->prev = NULL;
+  p->next = *slot;
+  if (*slot != NULL)
+    (*slot)->prev = p;
+  *slot = p;
+  s->ntimers++;
+}
+
+static void inserttimer(struct sim *s, struct event *p)
+{
+  if (TRACE>2) {
+    printf("            INSERTEVENT: time is %f\n",s->time);
+    printf("            INSERTEVENT: future time will be %f\n",p->evtime);
+  }
+  p->evseq = s->nextevseq++;      /* ordered against the heap's events as before */
+  linktimer(s, p);
+}
+
+/* take timer p out of the wheel, in O(1) */
+static void removetimer(struct sim *s, struct event *p)
+{
+  if (p == s->nexttimer)
+    s->nexttimer = NULL;
+  if (p->prev != NULL)
+    p->prev->next = p->next;
+  else
+    s->wheel[p->tick & (WHEELSLOTS-1)] = p->next;
+  if (p->next != NULL)
+    p->next->prev = p->prev;
+  s->ntimers--;
+}
+
+/* the first running timer if it is due before event bound (or bound is
+   NULL), otherwise NULL.  Moves the cursor up to the timer's tick, but
+   not past bound's */
+static struct event *firsttimer(struct sim *s, const struct event *bound)
+{
+  struct event *p, *first;
+  long boundtick = bound != NULL ? wheeltick(bound->evtime) : 0;
+  int empty = 0, i;
+
+  if ((first = s->nexttimer) != NULL)
+    return bound == NULL || earlier(first, bound) ? first : NULL;
+  while (s->ntimers > 0) {
+    first = NULL;
+    for (p = s->wheel[s->wheelcursor & (WHEELSLOTS-1)]; p != NULL; p = p->next)
+      if (p->tick == s->wheelcursor && (first == NULL || earlier(p, first)))
+        first = p;
+    if (first != NULL) {
+      s->nexttimer = first;
+      return bound == NULL || earlier(first, bound) ? first : NULL;
     }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
+    if (bound != NULL && s->wheelcursor >= boundtick)
+      return NULL;
+    s->wheelcursor++;
+    if (++empty == WHEELSLOTS) {
+      /* a whole turn without a due timer, jump to the earliest one */
+      for (i = 0; i < WHEELSLOTS; i++)
+        for (p = s->wheel[i]; p != NULL; p = p->next)
+          if (first == NULL || p->tick < first->tick)
+            first = p;
+      s->wheelcursor = bound != NULL && boundtick < first->tick ? boundtick : first->tick;
+      empty = 0;
     }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
+  }
+  return NULL;
+}
+
+/* remove the next event, from the heap or the wheel, and return it */
+static struct event *nextevent(struct sim *s)
+{
+  struct event *p;
+
+  if (s->ntimers > 0 && (p = firsttimer(s, s->nevents > 0 ? s->evheap[0] : NULL)) != NULL) {
+    removetimer(s, p);
+    return p;
+  }
+  if (s->nevents == 0)
+    return NULL;
+  return removeevent(s, 0);
+}
+
+/* every flow has its own stream of messages */
+static void generate_next_arrival(struct sim *s, int flow)
+{
+  double x;
+  struct event *evptr;
+
+  if (TRACE>2)
+    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+
+  x = s->lambda*jimsrand(s, RNG_ARRIVAL)*2;  /* x is uniform on [0,2*lambda] */
+  /* having mean of lambda        */
+  evptr = newevent(s);
+  evptr->evtime =  s->time + x;
+  evptr->evtype =  FROM_LAYER5;
+  evptr->flow = flow;
+  if (s->bidirectional && (jimsrand(s, RNG_ARRIVAL)>0.5) )
+    evptr->eventity = B;
+  else
+    evptr->eventity = A;
+  insertevent(s, evptr);
+}
+
+void printevlist(void)
+{
+  struct event *q;
+  int i;
+  printf("--------------\nEvent List Follows (heap order):\n");
+  for (i = 0; i < sim->nevents; i++) {
+    q = sim->evheap[i];
+    printf("Event time: %f, type: %d entity: %d flow: %d\n",q->evtime,q->evtype,q->eventity,q->flow);
+  }
+  printf("Timers (wheel order):\n");
+  for (i = 0; i < WHEELSLOTS; i++)
+    for (q = sim->wheel[(sim->wheelcursor + i) & (WHEELSLOTS-1)]; q != NULL; q = q->next)
+      printf("Event time: %f, type: %d entity: %d flow: %d\n",q->evtime,q->evtype,q->eventity,q->flow);
+  printf("--------------\n");
+}
+
+/********************* RUN PARAMETERS ****************/
+/* Parameters are given on the command line as        */
+/* key=value (or --key=value), or one per line in a   */
+/* file named by config=FILE.  Later values override  */
+/* earlier ones.                                      */
+/*****************************************************/
+
+static void freeprotoblocks(struct sim *s)
+{
+  union protoblock *b;
+
+  while ((b = s->protoblocks) != NULL) {
+    s->protoblocks = b->h.next;
+    free(b);
+  }
+}
+
+struct sim *sim_new(void)
+{
+  struct sim *s = calloc(1, sizeof(struct sim));
+
+  if (s == 0) {
+    printf("memory allocation for simulation failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->seed = DEFAULT_SEED;
+  return s;
+}
+
+void sim_free(struct sim *s)
+{
+  int i;
+
+  if (s->evlog != NULL)
+    evlog_close(s);
+  if (s->snapfile != NULL)
+    fclose(s->snapfile);
+  free(s->evheap);
+  freeeventpool(s);
+  for (i = 0; i < s->nflows; i++) {
+    free(s->flows[i].accepttimes[A]);
+    free(s->flows[i].accepttimes[B]);
+    free(s->flows[i].proto);
+  }
+  free(s->flows);
+  free(s->windows);
+  free(s->losstrace);
+  freeprotoblocks(s);
+  free(s);
+}
+
+static void readconfig(struct sim *s, const char *filename);
+
+/* add one key=value parameter, returns 0 if arg is not of that form */
+int sim_set(struct sim *s, const char *arg)
+{
+  const char *eq;
+  size_t keylen;
+  int i;
+
+  while (*arg == '-')
+    arg++;
+  eq = strchr(arg, '=');
+  if (eq == NULL || eq == arg || (keylen = eq - arg) >= MAXOPTKEY || strlen(eq+1) >= MAXOPTVALUE)
+    return 0;
+
+  if (keylen == 6 && strncmp(arg, "config", 6) == 0) {
+    readconfig(s, eq+1);
+    return 1;
+  }
+  for (i = 0; i < s->noptions; i++)
+    if (strncmp(s->options[i].key, arg, keylen) == 0 && s->options[i].key[keylen] == '\0')
+      break;
+  if (i == s->noptions) {
+    if (s->noptions == MAXOPTIONS) {
+      printf("too many parameters, at most %d can be given\n", MAXOPTIONS);
+      exit(EXIT_FAILURE);
+    }
+    s->noptions++;
+    memcpy(s->options[i].key, arg, keylen);
+    s->options[i].key[keylen] = '\0';
+  }
+  strcpy(s->options[i].value, eq+1);
+  s->options[i].used = 0;
+  return 1;
+}
+
+/* read key=value lines from a file, blank lines and lines starting with # are ignored */
+static void readconfig(struct sim *s, const char *filename)
+{
+  FILE *fp;
+  char line[MAXOPTKEY + MAXOPTVALUE + 8];
+  char *p, *end;
+  int lineno = 0;
+
+  if ((fp = fopen(filename, "r")) == NULL) {
+    printf("unable to open config file %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    for (p = line; *p == ' ' || *p == '\t'; p++)
+      ;
+    for (end = p + strlen(p); end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'); end--)
+      ;
+    *end = '\0';
+    if (*p == '\0' || *p == '#')
+      continue;
+    if (!sim_set(s, p)) {
+      printf("%s:%d: expected key=value, got \"%s\"\n", filename, lineno, p);
+      exit(EXIT_FAILURE);
     }
   }
+  fclose(fp);
+}
+
+/* parameter key, or NULL if it was not given */
+static struct option *findoption(struct sim *s, const char *key)
+{
+  int i;
+
+  for (i = 0; i < s->noptions; i++)
+    if (strcmp(s->options[i].key, key) == 0)
+      return &s->options[i];
+  return NULL;
+}
+
+/* value of parameter key for the drivers, or NULL if it was not given.
+   It stays unused, the emulator or the protocol still has to read it */
+const char *sim_get(struct sim *s, const char *key)
+{
+  struct option *o = findoption(s, key);
+
+  return o != NULL ? o->value : NULL;
+}
+
+/* value of parameter key, or NULL if it was not given; it no longer
+   counts as unknown for sim_checkoptions() */
+static const char *getoption(struct sim *s, const char *key)
+{
+  struct option *o = findoption(s, key);
+
+  if (o == NULL)
+    return NULL;
+  o->used = 1;
+  return o->value;
+}
+
+static void badoption(const char *key, const char *value)
+{
+  printf("invalid value \"%s\" for parameter %s\n", value, key);
+  exit(EXIT_FAILURE);
+}
+
+/* the following return 1 and set *value if the parameter was given */
+static int intoption(struct sim *s, const char *key, int *value)
+{
+  const char *str = getoption(s, key);
+  char *end;
+  long v;
+
+  if (str == NULL)
+    return 0;
+  v = strtol(str, &end, 10);
+  if (*str == '\0' || *end != '\0')
+    badoption(key, str);
+  *value = (int)v;
+  return 1;
+}
+
+static int floatoption(struct sim *s, const char *key, double *value)
+{
+  const char *str = getoption(s, key);
+  char *end;
+  double v;
+
+  if (str == NULL)
+    return 0;
+  v = strtod(str, &end);
+  if (*str == '\0' || *end != '\0')
+    badoption(key, str);
+  *value = v;
+  return 1;
+}
+
+/* parameter key of the link towards AorB: key_ab or key_ba if that was
+   given, else key.  None of them can be negative. */
+static int linkoption(struct sim *s, const char *key, int AorB, double *value)
+{
+  char dirkey[32];
+  int given = 0;
+
+  snprintf(dirkey, sizeof(dirkey), "%s_%s", key, AorB == B ? "ab" : "ba");
+  if (floatoption(s, key, value)) {
+    given = 1;
+    if (*value < 0)
+      badoption(key, getoption(s, key));
+  }
+  if (floatoption(s, dirkey, value)) {
+    given = 1;
+    if (*value < 0)
+      badoption(dirkey, getoption(s, dirkey));
+  }
+  return given;
+}
+
+static int linkintoption(struct sim *s, const char *key, int AorB, int *value)
+{
+  char dirkey[32];
+  int given = 0;
+
+  snprintf(dirkey, sizeof(dirkey), "%s_%s", key, AorB == B ? "ab" : "ba");
+  if (intoption(s, key, value)) {
+    given = 1;
+    if (*value < 0)
+      badoption(key, getoption(s, key));
+  }
+  if (intoption(s, dirkey, value)) {
+    given = 1;
+    if (*value < 0)
+      badoption(dirkey, getoption(s, dirkey));
+  }
+  return given;
+}
+
+static int seedoption(struct sim *s, const char *key, unsigned long *value)
+{
+  const char *str = getoption(s, key);
+  char *end;
+  unsigned long v;
+
+  if (str == NULL)
+    return 0;
+  v = strtoul(str, &end, 10);
+  if (*str == '\0' || *end != '\0')
+    badoption(key, str);
+  *value = v;
+  return 1;
+}
+
+/* warn about parameters nobody asked for, they are most likely typos */
+void sim_checkoptions(struct sim *s)
+{
+  int i;
+
+  for (i = 0; i < s->noptions; i++)
+    if (!s->options[i].used)
+      printf("Warning: unknown parameter %s ignored\n", s->options[i].key);
+}
+
+void sim_usage(void)
+{
+  printf("  messages=N      number of messages to simulate\n");
+  printf("  loss=P          packet loss probability\n");
+  printf("  lossmodel=M     bernoulli (default), gilbert (bursts) or trace (losstrace=FILE)\n");
+  printf("  burst=N         gilbert: mean packets in the bad state (default 4)\n");
+  printf("  lossgood=P      gilbert: loss probability in the good state (default 0)\n");
+  printf("  lossbad=P       gilbert: loss probability in the bad state (default 1)\n");
+  printf("  losstrace=FILE  a 1 or 0 per packet: lost or not, repeated as needed\n");
+  printf("  reorder=P       probability that a packet is held up and can be overtaken\n");
+  printf("  reorderdelay=T  the longest hold up (default 10)\n");
+  printf("  corrupt=P       packet corruption probability\n");
+  printf("  direction=D     loss/corruption direction: 0 A->B, 1 A<-B, 2 both\n");
+  printf("  lambda=T        average time between messages from sender's layer5\n");
+  printf("  trace=N         TRACE level\n");
+  printf("  seed=N          random seed (default %d)\n", DEFAULT_SEED);
+  printf("  stats=FORMAT    also dump statistics as csv or json\n");
+  printf("  statsfile=FILE  append the statistics to FILE instead of stdout\n");
+  printf("  statinterval=T  report goodput, latency and utilisation per T time units\n");
+  printf("  evlog=FILE      write a binary event trace for evreplay to FILE\n");
+  printf("  checkpoint=FILE save the whole state to FILE at checkpointat=T and stop\n");
+  printf("  restore=FILE    continue from a checkpoint, with these parameters\n");
+  printf("  snapshot=T      print a live snapshot as a JSON line every T time units\n");
+  printf("  snapshotms=X    or every X ms of wall-clock time, from a thread of gbn and sr\n");
+  printf("  snapshotfile=FILE append the snapshots to FILE instead of stdout\n");
+  printf("  window=N        sender window size of the protocol\n");
+  printf("  seqspace=N      number of sequence numbers of the protocol\n");
+  printf("  dupthresh=N     duplicate ACKs that make GBN resend at once (0 = off)\n");
+  printf("  sack=1          SR ACKs carry a selective acknowledgement bitmap\n");
+  printf("  ackdelay=T      B holds in-order ACKs for up to T time units (0 = off)\n");
+  printf("  ackevery=N      with ackdelay, B ACKs at the latest every N packets (default 2)\n");
+  printf("  checksum=KIND   packet checksum: sum (default), inet or crc32c\n");
+  printf("  bidirectional=1 B sends messages to A too, ACKs go along with data\n");
+  printf("  queue=N         messages that can wait for a full window (default 0)\n");
+  printf("  cc=1            congestion control: slow start, AIMD, GBN fast recovery\n");
+  printf("  payload=N       bytes of data in every message and packet (default 20)\n");
+  printf("  flows=N         pairs of A and B sharing the channels (messages= counts all)\n");
+  printf("  bandwidth=B     link model: bytes per time unit the links carry (0 = no limit)\n");
+  printf("  propdelay=T     link model: propagation delay of the links\n");
+  printf("                  jitter= to redmax= below need one of these two\n");
+  printf("  jitter=T        mean extra delay of a packet on the links (default 0)\n");
+  printf("  jitterdist=D    jitter distribution: uniform (default) or exponential\n");
+  printf("  linkqueue=N     packets the link queues hold (default 0 = no limit)\n");
+  printf("  aqm=KIND        link queue discipline: droptail (default) or red\n");
+  printf("  redmin=Q        RED starts dropping at this average queue (default linkqueue/4)\n");
+  printf("  redmax=Q        and drops everything from here (default 3*linkqueue/4)\n");
+  printf("                  the link parameters take _ab or _ba to set one direction\n");
+  printf("  config=FILE     read key=value lines from FILE\n");
+}
+
+/* prompts are flushed by hand as stdout may be fully buffered */
+static void prompt(const char *format, ...)
+{
+  va_list ap;
+
+  va_start(ap, format);
+  vprintf(format, ap);
+  va_end(ap);
+  fflush(stdout);
+}
+
+static void settrace(int trace)
+{
+#ifdef TRACE_LEVEL
+  if (trace != TRACE_LEVEL)   /* branches for other levels were compiled out */
+    printf("Warning: this build only supports TRACE=%d, trace=%d ignored\n", TRACE_LEVEL, trace);
+#else
+  TRACE = trace;
+#endif
+}
+
+/* a parameter that has no default is missing in a non-interactive run */
+static void missingoption(const char *key)
+{
+  printf("parameter %s must be given\n", key);
+  exit(EXIT_FAILURE);
+}
+
+/* read a loss trace: 1 for a lost packet, 0 for one that gets through.
+   Blanks are ignored and # starts a comment that runs to the end of the line */
+static void readlosstrace(struct sim *s, const char *filename)
+{
+  FILE *fp;
+  size_t size = 1024;
+  int c, comment = 0;
+
+  if ((fp = fopen(filename, "r")) == NULL) {
+    printf("unable to open loss trace %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  s->losstracelen = 0;
+  if ((s->losstrace = malloc(size)) == NULL) {
+    printf("memory allocation for loss trace failed.");
+    exit(EXIT_FAILURE);
+  }
+  while ((c = getc(fp)) != EOF) {
+    if (c == '\n')
+      comment = 0;
+    if (comment || c == ' ' || c == '\t' || c == '\r' || c == '\n')
+      continue;
+    if (c == '#') {
+      comment = 1;
+      continue;
+    }
+    if (c != '0' && c != '1') {
+      printf("loss trace %s: expected 0 or 1, got '%c'\n", filename, c);
+      exit(EXIT_FAILURE);
+    }
+    if (s->losstracelen == size) {
+      size *= 2;
+      if ((s->losstrace = realloc(s->losstrace, size)) == NULL) {
+        printf("memory allocation for loss trace failed.");
+        exit(EXIT_FAILURE);
+      }
+    }
+    s->losstrace[s->losstracelen++] = c == '1';
+  }
+  fclose(fp);
+  if (s->losstracelen == 0) {
+    printf("loss trace %s is empty\n", filename);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* the loss model and reordering parameters */
+static void configureloss(struct sim *s)
+{
+  const char *str, *trace = getoption(s, "losstrace");
+  double pibad;
+
+  s->lossmodel = trace != NULL ? LOSS_TRACE : LOSS_BERNOULLI;
+  if ((str = getoption(s, "lossmodel")) != NULL) {
+    if (strcmp(str, "bernoulli") == 0)
+      s->lossmodel = LOSS_BERNOULLI;
+    else if (strcmp(str, "gilbert") == 0)
+      s->lossmodel = LOSS_GILBERT;
+    else if (strcmp(str, "trace") == 0)
+      s->lossmodel = LOSS_TRACE;
+    else
+      badoption("lossmodel", str);
+  }
+
+  /* the bad state is left after burst packets on average, and entered
+     often enough that the mean loss comes out at lossprob */
+  s->burst = BURST;
+  s->lossgood = 0.0;
+  s->lossbad = 1.0;
+  if (s->lossmodel == LOSS_GILBERT) {
+    if (floatoption(s, "burst", &s->burst) && s->burst < 1)
+      badoption("burst", getoption(s, "burst"));
+    if (floatoption(s, "lossgood", &s->lossgood) && (s->lossgood < 0 || s->lossgood > 1))
+      badoption("lossgood", getoption(s, "lossgood"));
+    if (floatoption(s, "lossbad", &s->lossbad) && (s->lossbad < 0 || s->lossbad > 1))
+      badoption("lossbad", getoption(s, "lossbad"));
+    if (s->lossgood > s->lossprob || s->lossprob >= s->lossbad) {
+      printf("lossmodel=gilbert needs lossgood <= loss < lossbad\n");
+      exit(EXIT_FAILURE);
+    }
+    pibad = (s->lossprob - s->lossgood) / (s->lossbad - s->lossgood);
+    s->ger = 1.0 / s->burst;
+    s->gep = s->ger * pibad / (1.0 - pibad);
+    if (s->gep > 1.0) {
+      printf("lossmodel=gilbert: bad periods of %g packets are too short for loss=%g\n", s->burst, s->lossprob);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (s->lossmodel == LOSS_TRACE) {
+    if (trace == NULL)
+      missingoption("losstrace");
+    readlosstrace(s, trace);
+  }
+
+  if (floatoption(s, "reorder", &s->reorder) && (s->reorder < 0 || s->reorder > 1))
+    badoption("reorder", getoption(s, "reorder"));
+  s->reorderdelay = REORDERDELAY;
+  if (floatoption(s, "reorderdelay", &s->reorderdelay) && s->reorderdelay <= 0)
+    badoption("reorderdelay", getoption(s, "reorderdelay"));
+}
+
+/* the link model parameters, the model is only used if a bandwidth or
+   a propagation delay is given */
+static void configurelinks(struct sim *s)
+{
+  struct link *l;
+  const char *str, *linkonly = NULL;   /* a parameter given that needs the link model */
+  int jitterdist = JITTER_UNIFORM, aqm = AQM_DROPTAIL;
+  double v;
+  int i;
+
+  if ((str = getoption(s, "jitterdist")) != NULL) {
+    linkonly = "jitterdist";
+    if (strcmp(str, "exponential") == 0)
+      jitterdist = JITTER_EXPONENTIAL;
+    else if (strcmp(str, "uniform") != 0)
+      badoption("jitterdist", str);
+  }
+  if ((str = getoption(s, "aqm")) != NULL) {
+    linkonly = "aqm";
+    if (strcmp(str, "red") == 0)
+      aqm = AQM_RED;
+    else if (strcmp(str, "droptail") != 0)
+      badoption("aqm", str);
+  }
+
+  s->linkmodel = 0;
+  for (i = A; i <= B; i++) {
+    l = &s->link[i];
+    memset(l, 0, sizeof(*l));
+    l->jitterdist = jitterdist;
+    l->aqm = aqm;
+    if (linkoption(s, "bandwidth", i, &v)) {
+      l->bandwidth = v;
+      s->linkmodel = 1;
+    }
+    if (linkoption(s, "propdelay", i, &v)) {
+      l->propdelay = v;
+      s->linkmodel = 1;
+    }
+    if (linkoption(s, "jitter", i, &v)) {
+      l->jitter = v;
+      linkonly = "jitter";
+    }
+    if (linkintoption(s, "linkqueue", i, &l->limit))
+      linkonly = "linkqueue";
+    l->redmin = l->limit / 4.0;
+    l->redmax = 3 * l->limit / 4.0;
+    if (floatoption(s, "redmin", &v)) {
+      l->redmin = v;
+      linkonly = "redmin";
+    }
+    if (floatoption(s, "redmax", &v)) {
+      l->redmax = v;
+      linkonly = "redmax";
+    }
+    if (aqm == AQM_RED && (l->limit == 0 || l->redmin < 0 || l->redmax <= l->redmin)) {
+      printf("aqm=red needs linkqueue > 0 and 0 <= redmin < redmax\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  /* without the link model packets never queue on a link, these would do nothing */
+  if (linkonly != NULL && !s->linkmodel) {
+    printf("%s= needs the link model, give bandwidth= or propdelay= too\n", linkonly);
+    exit(EXIT_FAILURE);
+  }
+}
+
+void sim_configure(struct sim *s, int interactive)   /* initialize the simulator */
+{
+  const char *str;
+  int prompted = 0;     /* did we have to ask for anything? */
+  int trace;
+
+  if (!intoption(s, "messages", &s->nsimmax)) {
+    if (!interactive)
+      missingoption("messages");
+    prompt("Enter the number of messages to simulate: ");
+    scanf("%d",&s->nsimmax);
+    prompted = 1;
+  }
+  if (!floatoption(s, "loss", &s->lossprob) && interactive) {
+    prompt("Enter  packet loss probability [enter 0.0 for no loss]:");
+    scanf("%lf",&s->lossprob);
+    prompted = 1;
+  }
+  if (!floatoption(s, "corrupt", &s->corruptprob) && interactive) {
+    prompt("Enter packet corruption probability [0.0 for no corruption]:");
+    scanf("%lf",&s->corruptprob);
+    prompted = 1;
+  }
+  if (!intoption(s, "direction", &s->corruptdirection) && interactive &&
+      (s->lossprob != 0.0 || s->corruptprob != 0.0)) {
+    prompt("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&s->corruptdirection);
+    prompted = 1;
+  }
+  if (!floatoption(s, "lambda", &s->lambda)) {
+    if (!interactive)
+      missingoption("lambda");
+    prompt("Enter average time between messages from sender's layer5 [ > 0.0]:");
+    scanf("%lf",&s->lambda);
+    prompted = 1;
+  }
+  if (intoption(s, "trace", &trace))
+    settrace(trace);
+  else if (interactive) {
+    prompt("Enter TRACE:");
+    if (scanf("%d",&trace) == 1)
+      settrace(trace);
+    prompted = 1;
+  }
+  if (!seedoption(s, "seed", &s->seed) && prompted) {
+    prompt("Enter random seed [%d]:", DEFAULT_SEED);
+    if (scanf("%lu",&s->seed) != 1)   /* keep the default if no seed is given */
+      s->seed = DEFAULT_SEED;
+  }
+
+  s->statsformat = STATS_NONE;
+  if ((str = getoption(s, "stats")) != NULL) {
+    if (strcmp(str, "csv") == 0)
+      s->statsformat = STATS_CSV;
+    else if (strcmp(str, "json") == 0)
+      s->statsformat = STATS_JSON;
+    else if (strcmp(str, "none") != 0)
+      badoption("stats", str);
+  }
+  s->statsfilename = getoption(s, "statsfile");
+  if (floatoption(s, "statinterval", &s->statinterval) && s->statinterval < 0)
+    badoption("statinterval", getoption(s, "statinterval"));
+  if ((str = getoption(s, "evlog")) != NULL)
+    evlog_open(s, str);
+  if ((s->checkpointfile = getoption(s, "checkpoint")) != NULL &&
+      !floatoption(s, "checkpointat", &s->checkpointat))
+    missingoption("checkpointat");
+  s->restorefile = getoption(s, "restore");
+  if (floatoption(s, "snapshot", &s->snapinterval) && s->snapinterval < 0)
+    badoption("snapshot", getoption(s, "snapshot"));
+  if (floatoption(s, "snapshotms", &s->snapms) && s->snapms < 0)
+    badoption("snapshotms", getoption(s, "snapshotms"));
+  if ((str = getoption(s, "snapshotfile")) != NULL &&
+      (s->snapfile = fopen(str, "a")) == NULL) {
+    printf("unable to open snapshot file %s\n", str);
+    exit(EXIT_FAILURE);
+  }
+  s->bidirectional = BIDIRECTIONAL;
+  if (intoption(s, "bidirectional", &s->bidirectional) && s->bidirectional != 0 && s->bidirectional != 1)
+    badoption("bidirectional", getoption(s, "bidirectional"));
+  s->payloadsize = PAYLOAD;
+  if (intoption(s, "payload", &s->payloadsize) && (s->payloadsize < 1 || s->payloadsize > MAXPAYLOAD))
+    badoption("payload", getoption(s, "payload"));
+  configureloss(s);
+  configurelinks(s);
+  s->nflows = 1;
+  if (intoption(s, "flows", &s->nflows) && (s->nflows < 1 || s->nflows > MAXFLOWS))
+    badoption("flows", getoption(s, "flows"));
+  s->flows = calloc(s->nflows, sizeof(struct flow));
+  if (s->flows == NULL) {
+    printf("memory allocation for flows failed.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void init(struct sim *s)
+{
+  struct flow *f;
+  int i;
+
+  seedrandom(s);            /* init random number generators */
+
+  /* initialise statistics */
+  memset(&s->pstats, 0, sizeof(s->pstats));
+  for (i = 0; i < s->nflows; i++) {
+    f = &s->flows[i];
+    memset(&f->pstats, 0, sizeof(f->pstats));
+    f->timerevent[A] = f->timerevent[B] = NULL;
+    f->cwnd[A] = f->cwnd[B] = 0.0;
+    f->acceptfirst[A] = f->acceptfirst[B] = 0;
+    f->naccepted[A] = f->naccepted[B] = 0;
+    f->delivered = 0;
+    f->latencysum = 0.0;
+  }
+  s->messages_delivered = 0;
+  s->ndispatched = 0;
+  s->nallocs = 0;
+  s->inflight = 0;
+  s->nsim = 0;
+  s->ntolayer3 = 0;
+  s->nlost = 0;
+  s->ncorrupt = 0;
+  s->nlinkdrops = 0;
+  s->nreddrops = 0;
+  s->nlossbursts = 0;
+  s->nreordered = 0;
+  s->cwndreported = 0;
+  s->cwnd[A] = s->cwnd[B] = 0.0;
+  memset(s->latcounts, 0, sizeof(s->latcounts));
+  s->nlatencies = 0;
+  s->latencysum = 0.0;
+  s->latencymax = 0.0;
+  s->busy[A] = s->busy[B] = 0.0;
+  s->nwindows = 0;
+  if (s->windows != NULL)
+    memset(s->windows, 0, s->maxwindows * sizeof(struct statwindow));
+
+  s->channeltail[A] = 0.0;
+  s->channeltail[B] = 0.0;
+  for (i = A; i <= B; i++) {
+    s->gebad[i] = 0;
+    s->tracepos[i] = 0;
+    s->lastlost[i] = 0;
+    s->link[i].linkfree = 0.0;
+    s->link[i].redavg = 0.0;
+    s->link[i].redcount = -1;
+  }
+  s->time=0.0;                 /* initialize time to 0.0 */
+
+  freeprotoblocks(s);
+  s->nprotopointers = 0;
+  for (i = 0; i < s->nflows; i++) {
+    f = &s->flows[i];
+    free(f->proto);
+    f->proto = calloc(1, protocol_state_size);
+    s->nallocs++;
+    if (f->proto == 0) {
+      printf("memory allocation for protocol state failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s->flow = 0;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+struct protocol_stats *protocol_stats(void)
+{
+  return &sim->flows[sim->flow].pstats;
+}
+
+void *protocol_state(void)
+{
+  return sim->flows[sim->flow].proto;
+}
+
+void *protocol_alloc(size_t size)
+{
+  union protoblock *b = calloc(1, sizeof(union protoblock) + size);
+
+  sim->nallocs++;
+  if (b == 0) {
+    printf("memory allocation for protocol buffers failed.");
+    exit(EXIT_FAILURE);
+  }
+  b->h.next = sim->protoblocks;
+  b->h.size = size;
+  sim->protoblocks = b;
+  return b + 1;
+}
+
+void protocol_pointer(void *field)
+{
+  struct sim *s = sim;
+  uintptr_t proto = (uintptr_t)s->flows[s->flow].proto;
+  size_t offset = (uintptr_t)field - proto;
+  int i;
+
+  if ((uintptr_t)field < proto || offset + sizeof(void *) > protocol_state_size) {
+    printf("protocol_pointer(): the pointer is not in the protocol state\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < s->nprotopointers; i++)   /* every flow registers the same fields */
+    if (s->protopointers[i] == offset)
+      return;
+  if (s->nprotopointers == MAXPROTOPOINTERS) {
+    printf("protocol_pointer(): at most %d pointers can be registered\n", MAXPROTOPOINTERS);
+    exit(EXIT_FAILURE);
+  }
+  s->protopointers[s->nprotopointers++] = offset;
+}
+
+int protocol_option(const char *key, int defvalue)
+{
+  int value;
+
+  if (!intoption(sim, key, &value))
+    return defvalue;
+  return value;
 }
 
-void generate_next_arrival(void)
+double protocol_float_option(const char *key, double defvalue)
 {
-  double x;
-  struct event *evptr;
+  double value;
 
-  if (TRACE>2)
-    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
- 
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + x;
-  evptr->evtype =  FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand()>0.5) )
-    evptr->eventity = B;
-  else
-    evptr->eventity = A;
-  insertevent(evptr);
-} 
+  if (!floatoption(sim, key, &value))
+    return defvalue;
+  return value;
+}
 
-void printevlist(void)
+const char *protocol_string_option(const char *key, const char *defvalue)
 {
-  struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
-  }
-  printf("--------------\n");
+  const char *value = getoption(sim, key);
+
+  return value != NULL ? value : defvalue;
+}
+
+void protocol_badoption(const char *key, const char *why)
+{
+  printf("invalid value \"%s\" for parameter %s: %s\n", getoption(sim, key), key, why);
+  exit(EXIT_FAILURE);
 }
 
-void init(void)                         /* initialize the simulator */
+void protocol_cwnd(int AorB, double cwnd, double ssthresh)
 {
-  float sum, avg;
+  struct sim *s = sim;
+  struct evrecord *r;
   int i;
 
-  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
-    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d",&corruptdirection);
-  }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
-  printf("Enter TRACE:");
-  scanf("%d",&TRACE);
-
-
-  srand(9999);              /* init random number generator */
-  sum = 0.0;                /* test random number generator for students */
-  for (i=0; i<1000; i++)
-    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
-  avg = sum/1000.0;
-  if (avg < 0.25 || avg > 0.75) {
-    printf("It is likely that random number generation on your machine\n" ); 
-    printf("is different from what this emulator expects.  Please take\n");
-    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
-    exit(EXIT_FAILURE);
+  if (TRACE>2)
+    printf("          CWND: %s cwnd %.3f ssthresh %.3f\n", AorB == A ? "A" : "B", cwnd, ssthresh);
+  s->cwndreported = 1;
+  s->flows[s->flow].cwnd[AorB] = (float)cwnd;
+  s->cwnd[AorB] = 0.0;
+  for (i = 0; i < s->nflows; i++)
+    s->cwnd[AorB] += s->flows[i].cwnd[AorB];
+  if (s->statinterval > 0)
+    getwindow(s, s->time)->cwnd[AorB] = s->cwnd[AorB];
+  if (s->evlog != NULL) {
+    r = evlog_record(s, EVREC_CWND, AorB);
+    r->extra = cwnd;
+    r->seqnum = (int32_t)ssthresh;
   }
+}
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
-
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
-
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+double get_sim_time(void)
+{
+  return sim->time;
 }
 
-/********************** Student-callable ROUTINES ***********************/
+int get_payload_size(void)
+{
+  return sim->payloadsize;
+}
 
 /* called by students routine to cancel a previously-started timer */
 void stoptimer(int AorB)
 /* A or B is trying to stop timer */
 {
-  struct event *q;
+  struct sim *s = sim;
+  struct flow *f = &s->flows[s->flow];
 
   if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
+    printf("          STOP TIMER: stopping timer at %f\n",s->time);
+  if (s->evlog != NULL)
+    evlog_record(s, EVREC_STOPTIMER, AorB);
+  if (f->timerevent[AorB] != NULL) {
+    removetimer(s, f->timerevent[AorB]);
+    freeevent(s, f->timerevent[AorB]);
+    f->timerevent[AorB] = NULL;
+    return;
+  }
   printf("Warning: unable to cancel your timer. It wasn't running.\n");
 }
 
@@ -265,197 +1856,871 @@ void stoptimer(int AorB)
 void starttimer(int AorB, double increment)
 /* A or B is trying to start timer */
 {
-
-  struct event *q;
+  struct sim *s = sim;
+  struct flow *f = &s->flows[s->flow];
   struct event *evptr;
 
   if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
+    printf("          START TIMER: starting timer at %f\n",s->time);
+  if (s->evlog != NULL)
+    evlog_record(s, EVREC_STARTTIMER, AorB)->extra = increment;
   /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
- 
-  /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+  if (f->timerevent[AorB] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
   }
-  evptr->evtime =  time + increment;
+
+  /* create future event for when timer goes off */
+  evptr = newevent(s);
+  evptr->evtime =  s->time + increment;
   evptr->evtype =  TIMER_INTERRUPT;
-   
- 
   evptr->eventity = AorB;
-  insertevent(evptr);
-} 
+  evptr->flow = s->flow;
+  f->timerevent[AorB] = evptr;
+  inserttimer(s, evptr);
+}
 
 
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
+void tolayer3(int AorB, const struct pkt *packet)
 /* A or B is sending to network  */
 {
+  struct sim *s = sim;
   struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
-  int i;
+  struct event *evptr;
+  struct evrecord *r = NULL;
+  double lastime, x;
+  double sent = 0.0;
+
+  s->ntolayer3++;
+  if (s->evlog != NULL) {
+    r = evlog_record(s, EVREC_TOLAYER3, AorB);
+    r->seqnum = packet->seqnum;
+    r->acknum = packet->acknum;
+    r->datahash = datahash(s, packet->payload);
+  }
 
-  ntolayer3++;
+  /* with the link model the packet has to get through the link's queue */
+  if (s->linkmodel && !linksend(s, (AorB+1) % 2, &sent)) {
+    if (r != NULL)
+      r->flags |= EVREC_LOST | EVREC_QUEUEDROP;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet dropped by the link queue\n");
+    return;
+  }
 
-  /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
-    if (TRACE>0)    
+  /* simulate losses (with the link model the packet was sent and is lost on the way): */
+  if (lossdraw(s, (AorB+1) % 2) && (!(AorB == B && s->corruptdirection == A) && !(AorB == A && s->corruptdirection == B))) {
+    s->nlost++;
+    if (!s->lastlost[(AorB+1) % 2])
+      s->nlossbursts++;
+    s->lastlost[(AorB+1) % 2] = 1;
+    if (r != NULL)
+      r->flags |= EVREC_LOST;
+    if (TRACE>0)
       printf("          TOLAYER3: packet being lost\n");
     return;
-  }  
+  }
+  s->lastlost[(AorB+1) % 2] = 0;
 
   /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE>2)  {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
-    printf("\n");
+  /* to do something with the packet after we return back to him/her */
+  evptr = newevent(s);
+  if (evptr->pkt == NULL) {
+    evptr->pkt = malloc(PKTBYTES(s));
+    s->nallocs++;
+    if (evptr->pkt == NULL) {
+      printf("memory allocation for packet failed.");
+      exit(EXIT_FAILURE);
+    }
   }
+  mypktptr = evptr->pkt;
+  memcpy(mypktptr, packet, PKTBYTES(s));   /* header and payload in one go */
+  if (TRACE>2)
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d %.*s\n", mypktptr->seqnum,
+           mypktptr->acknum,  mypktptr->checksum, TRACEBYTES(s), mypktptr->payload);
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  /* fill in the future event for arrival of packet at the other side */
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+  evptr->flow = s->flow;
   /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
- 
+     the medium itself does not reorder, so the packet arrives between 1
+     and 10 time units after the latest arrival time of packets currently
+     in the medium on their way to the destination.  Only reorder= below
+     can hold it up past the packets behind it */
+  if (s->linkmodel)
+    evptr->evtime = linkarrival(s, evptr->eventity, sent);
+  else {
+    lastime = s->time;
+    if (s->channeltail[evptr->eventity] > lastime)   /* packets still in the medium */
+      lastime = s->channeltail[evptr->eventity];
+    evptr->evtime =  lastime + 1 + 9*jimsrand(s, RNG_DELAY);
+    channelbusy(s, evptr->eventity, lastime, evptr->evtime);
+  }
+  s->channeltail[evptr->eventity] = evptr->evtime;
+
+  /* a reordered packet keeps its place in the channel, the packets behind
+     it still arrive as if it had gone through, but it is held up on the way */
+  if (s->reorder > 0 && jimsrand(s, RNG_REORDER) < s->reorder) {
+    evptr->evtime += s->reorderdelay * (1.0 - jimsrand(s, RNG_REORDER));   /* (0, reorderdelay] */
+    s->nreordered++;
+    if (r != NULL)
+      r->flags |= EVREC_REORDERED;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being held up, it may arrive out of order\n");
+  }
+  if (r != NULL)
+    r->extra = evptr->evtime;
+
 
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
+  if ((jimsrand(s, RNG_CORRUPT) < s->corruptprob)  && (!(AorB == B && s->corruptdirection == A) && !(AorB == A && s->corruptdirection == B))) {
+    s->ncorrupt++;
+    if (r != NULL)
+      r->flags |= EVREC_CORRUPT;
+    if ( (x = jimsrand(s, RNG_CORRUPT)) < .75)
       mypktptr->payload[0]='Z';   /* corrupt payload */
     else if (x < .875)
       mypktptr->seqnum = 999999;
     else
       mypktptr->acknum = 999999;
-    if (TRACE>0)    
+    if (TRACE>0)
       printf("          TOLAYER3: packet being corrupted\n");
-  }  
+  }
 
-  if (TRACE>2)  
+  if (TRACE>2)
     printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
-} 
+  s->inflight++;
+  insertevent(s, evptr);
+}
 
-void tolayer5(int AorB, char datasent[20])
+void tolayer5(int AorB, const char *datasent)
 {
-  int i;  
-  if (TRACE>2) {
-    printf("          TOLAYER5: data received by application at ");
-    if (AorB == A) 
-      printf("A: ");
+  struct sim *s = sim;
+  struct evrecord *r;
+
+  if (TRACE>2)
+    printf("          TOLAYER5: data received by application at %s: %.*s\n",
+           AorB == A ? "A" : "B", TRACEBYTES(s), datasent);
+  if (s->evlog != NULL) {
+    r = evlog_record(s, EVREC_TOLAYER5, AorB);
+    r->seqnum = s->messages_delivered;
+    r->datahash = datahash(s, datasent);
+  }
+  s->messages_delivered++;
+  messagedelivered(s, &s->flows[s->flow], AorB == A ? B : A);
+}
+
+/********************* LIVE SNAPSHOTS ****************/
+/* While snapshot=T or snapshotms=X is given, the     */
+/* dispatch loop publishes its counters in s->snap    */
+/* every SNAP_EVENTS events, for sim_snapshot() in    */
+/* another thread.  The writer makes the sequence     */
+/* word odd, stores the words of the snapshot and     */
+/* makes it even again.  A reader loads the words     */
+/* until it saw the same even number before and       */
+/* after, so neither side ever waits for the other.   */
+/* All of them are atomic, relaxed ones for the data, */
+/* and the reader stamps the wall-clock time: the     */
+/* run only reads the clock for the snapshot=T lines  */
+/* it prints itself, main.c's reader thread prints    */
+/* the snapshotms=X ones.                             */
+/*****************************************************/
+
+static double wallclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the counters now, with the clock reading at */
+static void fillsnapshot(struct sim *s, struct sim_snapshot *n, double at)
+{
+  const struct protocol_stats *ps;
+  int i;
+
+  memset(n, 0, sizeof(*n));
+  n->time = at;
+  n->events = s->ndispatched;
+  n->delivered = s->messages_delivered;
+  n->inflight = s->inflight;
+  n->sent = s->ntolayer3;
+  for (i = 0; i < s->nflows; i++) {
+    ps = &s->flows[i].pstats;
+    n->resent += ps->packets_resent;
+    n->queued += ps->queue_depth;
+    n->window_full += ps->window_full;
+  }
+}
+
+void sim_snapshot_rates(struct sim_snapshot *n, const struct sim_snapshot *o)
+{
+  n->events_per_sec = n->wall > o->wall ? (n->events - o->events) / (n->wall - o->wall) : 0.0;
+  n->throughput = n->time > o->time ? (n->delivered - o->delivered) / (n->time - o->time) : 0.0;
+  n->resent_rate = n->sent > o->sent ? (double)(n->resent - o->resent) / (n->sent - o->sent) : 0.0;
+}
+
+static void publishsnapshot(struct sim *s, const struct sim_snapshot *n)
+{
+  unsigned long seq = SEQ_LOAD(&s->snapseq, relaxed), words[SNAPWORDS];
+  size_t i;
+
+  memset(words, 0, sizeof(words));
+  memcpy(words, n, sizeof(*n));
+  SEQ_STORE(&s->snapseq, seq + 1, relaxed);
+  SEQ_FENCE(release);               /* odd before any of the data changes */
+  for (i = 0; i < SNAPWORDS; i++)
+    SEQ_STORE(&s->snap[i], words[i], relaxed);
+  SEQ_STORE(&s->snapseq, seq + 2, release);
+}
+
+int sim_snapshot(struct sim *s, struct sim_snapshot *snap)
+{
+  unsigned long seq, words[SNAPWORDS];
+  size_t i;
+
+  do {
+    while ((seq = SEQ_LOAD(&s->snapseq, acquire)) & 1)
+      ;
+    if (seq == 0)
+      return 0;
+    for (i = 0; i < SNAPWORDS; i++)
+      words[i] = SEQ_LOAD(&s->snap[i], relaxed);
+    SEQ_FENCE(acquire);             /* the data is read before the second look */
+  } while (SEQ_LOAD(&s->snapseq, relaxed) != seq);
+  memcpy(snap, words, sizeof(*snap));
+  snap->wall = wallclock() - s->wallstart;   /* set before the first publication */
+  return 1;
+}
+
+void sim_print_snapshot(struct sim *s, const struct sim_snapshot *n)
+{
+  FILE *f = s->snapfile != NULL ? s->snapfile : stdout;
+
+  fprintf(f, "{\"snapshot\":%ld,\"time\":%.6f,\"wall\":%.6f,\"events\":%ld,\"events_per_sec\":%.1f,"
+          "\"delivered\":%d,\"throughput\":%.6f,\"inflight\":%d,\"sent\":%d,\"resent\":%d,"
+          "\"resent_rate\":%.6f,\"queue\":%d,\"window_full\":%d}\n",
+          n->number, n->time, n->wall, n->events, n->events_per_sec, n->delivered, n->throughput,
+          n->inflight, n->sent, n->resent, n->resent_rate, n->queued, n->window_full);
+  fflush(f);
+}
+
+/* publish the counters now */
+static void publishnow(struct sim *s)
+{
+  struct sim_snapshot n;
+
+  fillsnapshot(s, &n, s->time);
+  publishsnapshot(s, &n);
+}
+
+/* print the snapshot= line of time at */
+static void takesnapshot(struct sim *s, double at)
+{
+  struct sim_snapshot n;
+
+  fillsnapshot(s, &n, at);
+  publishsnapshot(s, &n);
+  n.wall = wallclock() - s->wallstart;
+  sim_snapshot_rates(&n, &s->lastsnap);
+  n.number = s->lastsnap.number + 1;
+  sim_print_snapshot(s, &n);
+  s->lastsnap = n;
+}
+
+/* the first snapshot is due after the time of the last event, so a
+   restored run carries on where the checkpointed one stopped */
+static void startsnapshots(struct sim *s)
+{
+  s->wallstart = wallclock();
+  fillsnapshot(s, &s->lastsnap, s->time);   /* the base the rates start from */
+  publishsnapshot(s, &s->lastsnap);
+  if (s->snapinterval > 0)
+    s->nextsnap = (floor(s->time / s->snapinterval) + 1) * s->snapinterval;
+}
+
+/********************** SIMULATION DRIVER ***********************/
+
+/* add the statistics of one flow to the total */
+static void addstats(struct protocol_stats *t, const struct protocol_stats *f)
+{
+  t->total_ACKs_received += f->total_ACKs_received;
+  t->packets_resent += f->packets_resent;
+  t->new_ACKs += f->new_ACKs;
+  t->packets_received += f->packets_received;
+  t->window_full += f->window_full;
+  t->messages_queued += f->messages_queued;
+  if (f->queue_peak > t->queue_peak)
+    t->queue_peak = f->queue_peak;
+  t->queue_delay_sum += f->queue_delay_sum;
+  if (f->queue_delay_max > t->queue_delay_max)
+    t->queue_delay_max = f->queue_delay_max;
+  t->fast_retransmits += f->fast_retransmits;
+  t->acks_sent += f->acks_sent;
+  t->acks_piggybacked += f->acks_piggybacked;
+}
+
+/********************* CHECKPOINTS *******************/
+/* checkpoint=FILE checkpointat=T saves the whole     */
+/* state of the simulation just before the first      */
+/* event after time T, and the run ends there.        */
+/* restore=FILE carries on from that state, with the  */
+/* parameters of the new run: the loss, the links or  */
+/* lambda can differ.  The protocol state is taken    */
+/* over as it is, so the protocols keep the checkpoint */
+/* run's parameters, and the random streams continue  */
+/* whatever seed= says.                               */
+/*****************************************************/
+
+#define CKPT_MAGIC "RDTCKPT2"
+#define CKPT_ALIGN 8
+#define CKPT_ROUND(n) (((n) + CKPT_ALIGN-1) / CKPT_ALIGN * CKPT_ALIGN)
+
+/* The image is flat and position independent: the header gives the
+   offset of every section and each one is 8 byte aligned, so the file
+   is memory-mapped as it is by restore=.  It holds the structs of the
+   binary that wrote it, their sizes are in the header and checked.
+   Sections:
+     state        struct ckptstate, the emulator's clock, random streams,
+                  channel state and counters
+     flows        nflows struct ckptflow
+     protos       the protocol state of each flow, protostatebytes each
+     blocks       each protocol_alloc() block, newest first: a struct
+                  ckptblock with its size and address, then the data.  The
+                  pointers protocol_pointer() registered are moved from
+                  the saved addresses to the restored blocks
+     events       struct ckptevent for every pending event, followed by
+                  the packet if it is a FROM_LAYER3
+     windows      nwindows struct statwindow
+     accepttimes  the acceptance times of the undelivered messages, per
+                  flow, A then B, oldest first */
+struct ckptblock {
+  uint64_t size;
+  uint64_t addr;                /* where the data was in the checkpointed run */
+};
+
+struct ckptheader {
+  char magic[8];
+  uint32_t statebytes, flowbytes, eventbytes, windowbytes, pktbytes;
+  uint32_t nflows, nevents, nblocks, nwindows, naccepted;
+  uint64_t protostatebytes;
+  uint64_t state, flows, protos, blocks, events, windows, accepttimes, end;
+};
+
+struct ckptstate {
+  double time;
+  unsigned long nextevseq;
+  uint64_t rngstate[NRNGSTREAMS][4];
+  double channeltail[2];
+  int gebad[2];
+  size_t tracepos[2];
+  int lastlost[2];
+  double linkfree[2], redavg[2];
+  int redcount[2];
+  int messages_delivered, nsim, ntolayer3, nlost, ncorrupt;
+  int nlinkdrops, nreddrops, nlossbursts, nreordered;
+  int cwndreported;
+  float cwnd[2];
+  uint32_t latcounts[LAT_BUCKETS];
+  int nlatencies;
+  double latencysum, latencymax;
+  double busy[2];
+  long ndispatched;
+  double statinterval;          /* the windows only carry over with the same interval */
+};
+
+struct ckptflow {
+  struct protocol_stats pstats;
+  float cwnd[2];
+  int naccepted[2];
+  int delivered;
+  double latencysum;
+};
+
+struct ckptevent {
+  double evtime;
+  unsigned long evseq;
+  int evtype, eventity, flow;
+};
+
+/* write n bytes and pad them to CKPT_ALIGN */
+static void ckptwrite(FILE *f, const void *p, size_t n)
+{
+  static const char zeros[CKPT_ALIGN];
+
+  if (n > 0 && fwrite(p, 1, n, f) != n)
+    return;
+  fwrite(zeros, 1, CKPT_ROUND(n) - n, f);
+}
+
+static void writeevent(struct sim *s, FILE *f, const struct event *p)
+{
+  struct ckptevent e;
+
+  memset(&e, 0, sizeof(e));
+  e.evtime = p->evtime;
+  e.evseq = p->evseq;
+  e.evtype = p->evtype;
+  e.eventity = p->eventity;
+  e.flow = p->flow;
+  ckptwrite(f, &e, sizeof(e));
+  if (p->evtype == FROM_LAYER3)
+    ckptwrite(f, p->pkt, PKTBYTES(s));
+}
+
+static void writecheckpoint(struct sim *s, const char *filename)
+{
+  struct ckptheader h;
+  struct ckptstate st;
+  struct ckptflow cf;
+  struct flow *fl;
+  union protoblock *b;
+  struct event *p;
+  struct ckptblock cb;
+  FILE *f;
+  int i, j, k;
+
+  if ((f = fopen(filename, "wb")) == NULL) {
+    printf("unable to write checkpoint %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+  h.statebytes = sizeof(struct ckptstate);
+  h.flowbytes = sizeof(struct ckptflow);
+  h.eventbytes = sizeof(struct ckptevent);
+  h.windowbytes = sizeof(struct statwindow);
+  h.pktbytes = (uint32_t)PKTBYTES(s);
+  h.nflows = s->nflows;
+  h.nevents = s->nevents + s->ntimers;
+  h.nwindows = s->nwindows;
+  h.protostatebytes = protocol_state_size;
+  h.state = CKPT_ROUND(sizeof(h));
+  h.flows = h.state + CKPT_ROUND(sizeof(st));
+  h.protos = h.flows + (uint64_t)s->nflows * CKPT_ROUND(sizeof(cf));
+  h.blocks = h.protos + (uint64_t)s->nflows * CKPT_ROUND(protocol_state_size);
+  h.events = h.blocks;
+  for (b = s->protoblocks; b != NULL; b = b->h.next) {
+    h.nblocks++;
+    h.events += sizeof(struct ckptblock) + CKPT_ROUND(b->h.size);
+  }
+  h.windows = h.events + (uint64_t)h.nevents * CKPT_ROUND(sizeof(struct ckptevent));
+  for (i = 0; i < s->nevents; i++)
+    if (s->evheap[i]->evtype == FROM_LAYER3)
+      h.windows += CKPT_ROUND(PKTBYTES(s));
+  h.accepttimes = h.windows + (uint64_t)s->nwindows * CKPT_ROUND(sizeof(struct statwindow));
+  for (i = 0; i < s->nflows; i++)
+    h.naccepted += s->flows[i].naccepted[A] + s->flows[i].naccepted[B];
+  h.end = h.accepttimes + (uint64_t)h.naccepted * sizeof(double);
+  ckptwrite(f, &h, sizeof(h));
+
+  memset(&st, 0, sizeof(st));
+  st.time = s->time;
+  st.nextevseq = s->nextevseq;
+  memcpy(st.rngstate, s->rngstate, sizeof(st.rngstate));
+  for (i = A; i <= B; i++) {
+    st.channeltail[i] = s->channeltail[i];
+    st.gebad[i] = s->gebad[i];
+    st.tracepos[i] = s->tracepos[i];
+    st.lastlost[i] = s->lastlost[i];
+    st.linkfree[i] = s->link[i].linkfree;
+    st.redavg[i] = s->link[i].redavg;
+    st.redcount[i] = s->link[i].redcount;
+    st.cwnd[i] = s->cwnd[i];
+    st.busy[i] = s->busy[i];
+  }
+  st.messages_delivered = s->messages_delivered;
+  st.nsim = s->nsim;
+  st.ntolayer3 = s->ntolayer3;
+  st.nlost = s->nlost;
+  st.ncorrupt = s->ncorrupt;
+  st.nlinkdrops = s->nlinkdrops;
+  st.nreddrops = s->nreddrops;
+  st.nlossbursts = s->nlossbursts;
+  st.nreordered = s->nreordered;
+  st.cwndreported = s->cwndreported;
+  memcpy(st.latcounts, s->latcounts, sizeof(st.latcounts));
+  st.nlatencies = s->nlatencies;
+  st.latencysum = s->latencysum;
+  st.latencymax = s->latencymax;
+  st.ndispatched = s->ndispatched;
+  st.statinterval = s->statinterval;
+  ckptwrite(f, &st, sizeof(st));
+
+  for (i = 0; i < s->nflows; i++) {
+    fl = &s->flows[i];
+    memset(&cf, 0, sizeof(cf));
+    cf.pstats = fl->pstats;
+    cf.cwnd[A] = fl->cwnd[A];
+    cf.cwnd[B] = fl->cwnd[B];
+    cf.naccepted[A] = fl->naccepted[A];
+    cf.naccepted[B] = fl->naccepted[B];
+    cf.delivered = fl->delivered;
+    cf.latencysum = fl->latencysum;
+    ckptwrite(f, &cf, sizeof(cf));
+  }
+  for (i = 0; i < s->nflows; i++)
+    ckptwrite(f, s->flows[i].proto, protocol_state_size);
+  for (b = s->protoblocks; b != NULL; b = b->h.next) {
+    cb.size = b->h.size;
+    cb.addr = (uintptr_t)(b + 1);
+    fwrite(&cb, sizeof(cb), 1, f);
+    ckptwrite(f, b + 1, b->h.size);
+  }
+
+  /* the events, in no particular order: (evtime, evseq) orders them again */
+  for (i = 0; i < s->nevents; i++)
+    writeevent(s, f, s->evheap[i]);
+  for (i = 0; i < WHEELSLOTS; i++)
+    for (p = s->wheel[i]; p != NULL; p = p->next)
+      writeevent(s, f, p);
+  ckptwrite(f, s->windows, s->nwindows * sizeof(struct statwindow));
+  for (i = 0; i < s->nflows; i++)
+    for (j = A; j <= B; j++) {
+      fl = &s->flows[i];
+      for (k = 0; k < fl->naccepted[j]; k++)
+        fwrite(&fl->accepttimes[j][(fl->acceptfirst[j] + k) % fl->maxaccepted[j]], sizeof(double), 1, f);
+    }
+
+  if (ferror(f) || fclose(f) != 0) {
+    printf("unable to write checkpoint %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  printf("checkpoint of time %f written to %s\n", s->time, filename);
+}
+
+/* the whole checkpoint file mapped into memory, checked against this
+   simulation.  The restore copies out of the page cache directly */
+static char *readcheckpoint(struct sim *s, const char *filename, size_t *size)
+{
+  const struct ckptheader *h;
+  struct stat st;
+  char *image;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+    printf("unable to read checkpoint %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  *size = (size_t)st.st_size;
+  if (*size < sizeof(struct ckptheader) ||
+      (image = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    printf("%s is not a checkpoint of this program\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  h = (const struct ckptheader *)image;
+  if (memcmp(h->magic, CKPT_MAGIC, sizeof(h->magic)) != 0 ||
+      h->statebytes != sizeof(struct ckptstate) || h->flowbytes != sizeof(struct ckptflow) ||
+      h->eventbytes != sizeof(struct ckptevent) || h->windowbytes != sizeof(struct statwindow) ||
+      h->protostatebytes != protocol_state_size || h->end != *size) {
+    printf("%s is not a checkpoint of this program\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  if (h->nflows != (uint32_t)s->nflows || h->pktbytes != PKTBYTES(s)) {
+    printf("checkpoint %s was taken with flows=%u and payload=%u\n", filename, h->nflows,
+           h->pktbytes - (uint32_t)offsetof(struct pkt, payload));
+    exit(EXIT_FAILURE);
+  }
+  return image;
+}
+
+/* discard the events the protocol's A_init()/B_init() set up */
+static void dropevents(struct sim *s)
+{
+  struct event *p;
+  int i;
+
+  while ((p = nextevent(s)) != NULL)
+    freeevent(s, p);
+  for (i = 0; i < s->nflows; i++)
+    s->flows[i].timerevent[A] = s->flows[i].timerevent[B] = NULL;
+}
+
+/* move the pointer at field from the block address it had in the
+   checkpointed run to the same place in this run's copy of the block */
+static void rebasepointer(struct sim *s, const char *blocks, uint32_t nblocks, void *field)
+{
+  struct ckptblock cb;
+  union protoblock *b;
+  uintptr_t old;
+  uint32_t n;
+  void *p;
+
+  memcpy(&p, field, sizeof(p));
+  if (p == NULL)
+    return;
+  old = (uintptr_t)p;
+  for (b = s->protoblocks, n = 0; n < nblocks; b = b->h.next, n++) {
+    memcpy(&cb, blocks, sizeof(cb));
+    if (old >= cb.addr && old - cb.addr <= cb.size) {
+      p = (char *)(b + 1) + (old - cb.addr);
+      memcpy(field, &p, sizeof(p));
+      return;
+    }
+    blocks += sizeof(cb) + CKPT_ROUND(cb.size);
+  }
+  printf("checkpoint: a pointer in the protocol state does not point into a protocol_alloc() block\n");
+  exit(EXIT_FAILURE);
+}
+
+static void restorecheckpoint(struct sim *s, const char *filename)
+{
+  size_t imagesize;
+  char *image = readcheckpoint(s, filename, &imagesize);
+  const struct ckptheader *h = (const struct ckptheader *)image;
+  const struct ckptstate *st = (const struct ckptstate *)(image + h->state);
+  const struct ckptflow *cf = (const struct ckptflow *)(image + h->flows);
+  const struct ckptevent *e;
+  const double *accepttimes = (const double *)(image + h->accepttimes);
+  const char *q;
+  FILE *evlog = s->evlog;
+  struct ckptblock cb;
+  union protoblock *b;
+  struct event *p;
+  struct flow *f;
+  uint32_t n;
+  int i, j, newmax;
+
+  /* this run's blocks, from the protocols' own inits */
+  s->evlog = NULL;                /* none of this is part of the run */
+  for (i = 0; i < s->nflows; i++) {
+    s->flow = i;
+    A_init();
+    B_init();
+  }
+  dropevents(s);
+
+  /* with the checkpoint's data in them */
+  q = image + h->blocks;
+  for (b = s->protoblocks, n = 0; b != NULL; b = b->h.next, n++) {
+    memcpy(&cb, q, sizeof(cb));
+    if (n == h->nblocks || cb.size != b->h.size)
+      break;
+    memcpy(b + 1, q + sizeof(cb), b->h.size);
+    q += sizeof(cb) + CKPT_ROUND(b->h.size);
+  }
+  if (b != NULL || n != h->nblocks) {
+    printf("checkpoint %s was taken with other window=, seqspace= or queue= parameters\n", filename);
+    exit(EXIT_FAILURE);
+  }
+
+  /* and the checkpoint's protocol state, pointing into them */
+  for (i = 0; i < s->nflows; i++) {
+    memcpy(s->flows[i].proto, image + h->protos + i * CKPT_ROUND(protocol_state_size), protocol_state_size);
+    for (j = 0; j < s->nprotopointers; j++)
+      rebasepointer(s, image + h->blocks, h->nblocks, (char *)s->flows[i].proto + s->protopointers[j]);
+  }
+
+  s->time = st->time;
+  s->nextevseq = st->nextevseq;
+  memcpy(s->rngstate, st->rngstate, sizeof(s->rngstate));
+  for (i = A; i <= B; i++) {
+    s->channeltail[i] = st->channeltail[i];
+    s->gebad[i] = st->gebad[i];
+    s->tracepos[i] = s->losstracelen > 0 ? st->tracepos[i] % s->losstracelen : 0;
+    s->lastlost[i] = st->lastlost[i];
+    s->link[i].linkfree = st->linkfree[i];
+    s->link[i].redavg = st->redavg[i];
+    s->link[i].redcount = st->redcount[i];
+    s->cwnd[i] = st->cwnd[i];
+    s->busy[i] = st->busy[i];
+  }
+  s->messages_delivered = st->messages_delivered;
+  s->nsim = st->nsim;
+  s->ntolayer3 = st->ntolayer3;
+  s->nlost = st->nlost;
+  s->ncorrupt = st->ncorrupt;
+  s->nlinkdrops = st->nlinkdrops;
+  s->nreddrops = st->nreddrops;
+  s->nlossbursts = st->nlossbursts;
+  s->nreordered = st->nreordered;
+  s->cwndreported = st->cwndreported;
+  memcpy(s->latcounts, st->latcounts, sizeof(s->latcounts));
+  s->nlatencies = st->nlatencies;
+  s->latencysum = st->latencysum;
+  s->latencymax = st->latencymax;
+  s->ndispatched = st->ndispatched;
+
+  for (i = 0; i < s->nflows; i++) {
+    f = &s->flows[i];
+    f->pstats = cf[i].pstats;
+    f->delivered = cf[i].delivered;
+    f->latencysum = cf[i].latencysum;
+    for (j = A; j <= B; j++) {
+      f->cwnd[j] = cf[i].cwnd[j];
+      f->naccepted[j] = cf[i].naccepted[j];
+      f->acceptfirst[j] = 0;
+      if (f->naccepted[j] > f->maxaccepted[j]) {
+        newmax = f->maxaccepted[j] ? f->maxaccepted[j] : 64;
+        while (newmax < f->naccepted[j])
+          newmax *= 2;
+        free(f->accepttimes[j]);
+        f->accepttimes[j] = malloc(newmax * sizeof(double));
+        s->nallocs++;
+        if (f->accepttimes[j] == NULL) {
+          printf("memory allocation for latency ring failed.");
+          exit(EXIT_FAILURE);
+        }
+        f->maxaccepted[j] = newmax;
+      }
+      memcpy(f->accepttimes[j], accepttimes, f->naccepted[j] * sizeof(double));
+      accepttimes += f->naccepted[j];
+    }
+  }
+
+  if (s->statinterval > 0 && st->statinterval == s->statinterval && h->nwindows > 0) {
+    getwindow(s, (h->nwindows - 0.5) * s->statinterval);   /* makes room for them */
+    memcpy(s->windows, image + h->windows, h->nwindows * sizeof(struct statwindow));
+  }
+  else if (s->windows != NULL)
+    memset(s->windows, 0, s->maxwindows * sizeof(struct statwindow));
+  s->nwindows = st->statinterval == s->statinterval ? (int)h->nwindows : 0;
+
+  q = image + h->events;
+  for (n = 0; n < h->nevents; n++) {
+    e = (const struct ckptevent *)q;
+    q += CKPT_ROUND(sizeof(*e));
+    p = newevent(s);
+    p->evtime = e->evtime;
+    p->evseq = e->evseq;
+    p->evtype = e->evtype;
+    p->eventity = e->eventity;
+    p->flow = e->flow;
+    if (e->evtype == FROM_LAYER3) {
+      if (p->pkt == NULL) {
+        p->pkt = malloc(PKTBYTES(s));
+        s->nallocs++;
+        if (p->pkt == NULL) {
+          printf("memory allocation for packet failed.");
+          exit(EXIT_FAILURE);
+        }
+      }
+      memcpy(p->pkt, q, PKTBYTES(s));
+      q += CKPT_ROUND(PKTBYTES(s));
+      s->inflight++;
+    }
+    if (e->evtype == TIMER_INTERRUPT) {
+      s->flows[e->flow].timerevent[e->eventity] = p;
+      linktimer(s, p);
+    }
     else
-      printf("B: ");
-    for (i=0; i<20; i++)  
-      printf("%c",datasent[i]);
-    printf("\n");
+      pushevent(s, p);
   }
-  messages_delivered++;
+
+  s->evlog = evlog;
+  s->flow = 0;
+  munmap(image, imagesize);
+  if (TRACE>0)
+    printf("restored the checkpoint of time %f from %s\n", s->time, filename);
 }
 
-int main(void)
+void sim_run(struct sim *s)
 {
   struct event *eventptr;
+  struct flow *f;
   struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
+  struct evrecord *r;
+  int dropped, checkpointed = 0, i;
+
+  sim = s;
+  init(s);
+  if (s->restorefile != NULL)
+    restorecheckpoint(s, s->restorefile);
+  else {
+    for (i = 0; i < s->nflows; i++)
+      generate_next_arrival(s, i);    /* initialize event list */
+    for (i = 0; i < s->nflows; i++) {
+      s->flow = i;
+      A_init();
+      B_init();
+    }
+  }
+  if (s->snapinterval > 0 || s->snapms > 0)
+    startsnapshots(s);
+
   while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
+    eventptr = nextevent(s);        /* get next event to simulate */
+    if (eventptr == NULL)           /* no more events to simulate */
+      break;
+    if (s->checkpointfile != NULL && eventptr->evtime > s->checkpointat) {
+      if (eventptr->evtype == TIMER_INTERRUPT)   /* it waits in the checkpoint */
+        linktimer(s, eventptr);
       else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
+        pushevent(s, eventptr);
+      writecheckpoint(s, s->checkpointfile);
+      checkpointed = 1;
+      while ((eventptr = nextevent(s)) != NULL)
+        freeevent(s, eventptr);
+      break;
+    }
+    if (s->snapinterval > 0 && eventptr->evtime >= s->nextsnap) {
+      takesnapshot(s, s->nextsnap);
+      s->nextsnap = (floor(eventptr->evtime / s->snapinterval) + 1) * s->snapinterval;
+    }
+    /* the readers get the counters every SNAP_EVENTS events, publishing
+       them more often would cost more than the events */
+    if ((s->snapinterval > 0 || s->snapms > 0) && (s->ndispatched & (SNAP_EVENTS-1)) == 0)
+      publishnow(s);
+    s->ndispatched++;
+    s->flow = eventptr->flow;       /* the student routines act on this flow */
+    f = &s->flows[s->flow];
+    if (TRACE>=2) {
+      printf("\nEVENT time: %f,  type: %d%s entity: %d", eventptr->evtime, eventptr->evtype,
+             eventptr->evtype==0 ? ", timerinterrupt  " :
+             eventptr->evtype==1 ? ", fromlayer5 " : ", fromlayer3 ",
+             eventptr->eventity);
+      if (s->nflows > 1)
+        printf(" flow: %d", s->flow);
+      printf("\n");
+    }
+    s->time = eventptr->evtime;        /* update time to next event time */
+    if (s->evlog != NULL) {
+      r = evlog_record(s, EVREC_DISPATCH, eventptr->eventity);
+      r->evtype = (uint8_t)eventptr->evtype;
+      if (eventptr->evtype == FROM_LAYER3) {
+        r->seqnum = eventptr->pkt->seqnum;
+        r->acknum = eventptr->pkt->acknum;
+        r->datahash = datahash(s, eventptr->pkt->payload);
+      }
+      else if (eventptr->evtype == FROM_LAYER5)
+        r->seqnum = s->nsim;
     }
-    time = eventptr->evtime;        /* update time to next event time */
     if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
+      if (s->nsim < s->nsimmax) {
+        generate_next_arrival(s, s->flow);   /* set up future arrival */
+        /* fill in msg to give with string of same letter */
+        memset(msg2give.data, 97 + s->nsim % 26, s->payloadsize);
+        if (TRACE>2)
+          printf("          MAINLOOP: data given to student: %.*s\n", TRACEBYTES(s), msg2give.data);
+        s->nsim++;
+        dropped = f->pstats.window_full;
+        if (eventptr->eventity == A)
+          A_output(&msg2give);
         else
-          B_output(msg2give);  
+          B_output(&msg2give);
+        if (f->pstats.window_full == dropped)   /* the message was not refused */
+          messageaccepted(s, f, eventptr->eventity);
       }
       else if (TRACE > 2)
           printf("          FROM_LAYER5: no more messages to send: \n");
     }
     else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+      s->inflight--;
+      /* the packet stays in the event's buffer until the event is freed */
+      if (eventptr->eventity ==A)      /* deliver packet by calling */
+        A_input(eventptr->pkt);       /* appropriate entity */
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+        B_input(eventptr->pkt);
     }
     else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
+      f->timerevent[eventptr->eventity] = NULL;   /* timer is no longer running */
+      if (eventptr->eventity == A)
         A_timerinterrupt();
       else
         B_timerinterrupt();
@@ -463,16 +2728,235 @@ int main(void)
     else  {
       printf("INTERNAL PANIC: unknown event type \n");
     }
-    free(eventptr);
+    freeevent(s, eventptr);
+  }
+  if (s->checkpointfile != NULL && !checkpointed)
+    printf("Warning: the run ended before checkpointat=%f, no checkpoint was written\n", s->checkpointat);
+  if (s->snapinterval > 0 && s->lastsnap.events != s->ndispatched)
+    takesnapshot(s, s->time);       /* and one of the end */
+  else if (s->snapinterval > 0 || s->snapms > 0)
+    publishnow(s);
+  if (s->evlog != NULL)
+    evlog_flush(s);
+  for (i = 0; i < s->nflows; i++)
+    addstats(&s->pstats, &s->flows[i].pstats);
+  sim = NULL;
+}
+
+/* Jain's fairness index of the messages the flows delivered: 1 if they
+   all got the same share, 1/flows if one flow got everything */
+static double fairness(const struct sim *s)
+{
+  double sum = 0.0, sumsq = 0.0;
+  int i;
+
+  for (i = 0; i < s->nflows; i++) {
+    sum += s->flows[i].delivered;
+    sumsq += (double)s->flows[i].delivered * s->flows[i].delivered;
+  }
+  return sumsq > 0 ? sum * sum / (s->nflows * sumsq) : 1.0;
+}
+
+void sim_results(struct sim *s, struct sim_results *r)
+{
+  r->messages = s->nsimmax;
+  r->loss = s->lossprob;
+  r->corrupt = s->corruptprob;
+  r->direction = s->corruptdirection;
+  r->lambda = s->lambda;
+  r->seed = s->seed;
+  r->end_time = s->time;
+  r->msgs_sent = s->nsim;
+  r->window_full = s->pstats.window_full;
+  r->total_acks = s->pstats.total_ACKs_received;
+  r->new_acks = s->pstats.new_ACKs;
+  r->packets_resent = s->pstats.packets_resent;
+  r->packets_received = s->pstats.packets_received;
+  r->messages_delivered = s->messages_delivered;
+  r->tolayer3 = s->ntolayer3;
+  r->lost = s->nlost;
+  r->corrupted = s->ncorrupt;
+  r->peak_events = s->peakevents;
+  r->events = s->ndispatched;
+  r->allocations = s->nallocs;
+  r->messages_queued = s->pstats.messages_queued;
+  r->queue_peak = s->pstats.queue_peak;
+  r->queue_delay_mean = s->pstats.messages_queued > 0 ?
+    s->pstats.queue_delay_sum / s->pstats.messages_queued : 0.0;
+  r->queue_delay_max = s->pstats.queue_delay_max;
+  r->queue_depth_mean = s->time > 0 ? s->pstats.queue_delay_sum / s->time : 0.0;
+  r->fast_retransmits = s->pstats.fast_retransmits;
+  r->acks_sent = s->pstats.acks_sent;
+  r->acks_piggybacked = s->pstats.acks_piggybacked;
+  r->bidirectional = s->bidirectional;
+  r->payload = s->payloadsize;
+  r->link_drops = s->nlinkdrops;
+  r->red_drops = s->nreddrops;
+  r->loss_bursts = s->nlossbursts;
+  r->reordered = s->nreordered;
+  r->flows = s->nflows;
+  r->fairness = fairness(s);
+  r->latency_mean = s->nlatencies > 0 ? s->latencysum / s->nlatencies : 0.0;
+  r->latency_p50 = latpercentile(s, 0.50);
+  r->latency_p90 = latpercentile(s, 0.90);
+  r->latency_p99 = latpercentile(s, 0.99);
+  r->latency_max = s->latencymax;
+  r->goodput = s->time > 0 ? s->messages_delivered / s->time : 0.0;
+  r->util_ab = s->time > 0 ? s->busy[B] / s->time : 0.0;
+  r->util_ba = s->time > 0 ? s->busy[A] / s->time : 0.0;
+}
+
+/* dump the run parameters and statistics in machine readable form */
+static void printstats(struct sim *s)
+{
+  struct sim_results r;
+  FILE *statsfile = stdout;   /* where the machine readable stats go */
+  struct stat st;
+  int header = 1;             /* stdout always gets the CSV header */
+
+  if (s->statsformat == STATS_NONE)
+    return;
+  if (s->statsfilename != NULL) {
+    if ((statsfile = fopen(s->statsfilename, "a")) == NULL) {
+      printf("unable to open stats file %s\n", s->statsfilename);
+      exit(EXIT_FAILURE);
+    }
+    /* a file only gets it when it is new or empty, the other runs append rows */
+    header = fstat(fileno(statsfile), &st) == 0 && st.st_size == 0;
+  }
+  sim_results(s, &r);
+  if (s->statsformat == STATS_CSV) {
+    if (header)
+      fprintf(statsfile, "messages,loss,corrupt,direction,lambda,seed,end_time,msgs_sent,"
+              "window_full,total_acks,new_acks,packets_resent,packets_received,"
+              "messages_delivered,tolayer3,lost,corrupted,peak_events,latency_mean,"
+              "latency_p50,latency_p90,latency_p99,latency_max,goodput,util_ab,util_ba,"
+              "messages_queued,queue_peak,queue_delay_mean,queue_delay_max,queue_depth_mean,"
+              "fast_retransmits,acks_sent,acks_piggybacked,bidirectional,payload,link_drops,red_drops,"
+              "loss_bursts,reordered,flows,fairness,events,allocations\n");
+    fprintf(statsfile, "%d,%g,%g,%d,%g,%lu,%f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%f,%f,%f,%f,%f,%f,%f,%f,"
+            "%d,%d,%f,%f,%f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%f,%ld,%d\n",
+            r.messages, r.loss, r.corrupt, r.direction, r.lambda, r.seed, r.end_time, r.msgs_sent,
+            r.window_full, r.total_acks, r.new_acks, r.packets_resent, r.packets_received,
+            r.messages_delivered, r.tolayer3, r.lost, r.corrupted, r.peak_events, r.latency_mean,
+            r.latency_p50, r.latency_p90, r.latency_p99, r.latency_max, r.goodput, r.util_ab, r.util_ba,
+            r.messages_queued, r.queue_peak, r.queue_delay_mean, r.queue_delay_max, r.queue_depth_mean,
+            r.fast_retransmits, r.acks_sent, r.acks_piggybacked, r.bidirectional, r.payload,
+            r.link_drops, r.red_drops, r.loss_bursts, r.reordered,
+            r.flows, r.fairness, r.events, r.allocations);
+  }
+  else {
+    fprintf(statsfile, "{\"messages\":%d,\"loss\":%g,\"corrupt\":%g,\"direction\":%d,"
+            "\"lambda\":%g,\"seed\":%lu,\"end_time\":%f,\"msgs_sent\":%d,"
+            "\"window_full\":%d,\"total_acks\":%d,\"new_acks\":%d,\"packets_resent\":%d,"
+            "\"packets_received\":%d,\"messages_delivered\":%d,\"tolayer3\":%d,"
+            "\"lost\":%d,\"corrupted\":%d,\"peak_events\":%d,\"latency_mean\":%f,"
+            "\"latency_p50\":%f,\"latency_p90\":%f,\"latency_p99\":%f,\"latency_max\":%f,"
+            "\"goodput\":%f,\"util_ab\":%f,\"util_ba\":%f,\"messages_queued\":%d,"
+            "\"queue_peak\":%d,\"queue_delay_mean\":%f,\"queue_delay_max\":%f,"
+            "\"queue_depth_mean\":%f,\"fast_retransmits\":%d,\"acks_sent\":%d,"
+            "\"acks_piggybacked\":%d,\"bidirectional\":%d,\"payload\":%d,"
+            "\"link_drops\":%d,\"red_drops\":%d,\"loss_bursts\":%d,\"reordered\":%d,"
+            "\"flows\":%d,\"fairness\":%f,\"events\":%ld,\"allocations\":%d}\n",
+            r.messages, r.loss, r.corrupt, r.direction, r.lambda, r.seed, r.end_time, r.msgs_sent,
+            r.window_full, r.total_acks, r.new_acks, r.packets_resent, r.packets_received,
+            r.messages_delivered, r.tolayer3, r.lost, r.corrupted, r.peak_events, r.latency_mean,
+            r.latency_p50, r.latency_p90, r.latency_p99, r.latency_max, r.goodput, r.util_ab, r.util_ba,
+            r.messages_queued, r.queue_peak, r.queue_delay_mean, r.queue_delay_max, r.queue_depth_mean,
+            r.fast_retransmits, r.acks_sent, r.acks_piggybacked, r.bidirectional, r.payload,
+            r.link_drops, r.red_drops, r.loss_bursts, r.reordered,
+            r.flows, r.fairness, r.events, r.allocations);
+  }
+  if (statsfile != stdout)
+    fclose(statsfile);
+}
+
+/* table of the flows */
+static void printflows(struct sim *s)
+{
+  struct flow *f;
+  int i;
+
+  printf("\n     flow  delivered   goodput  mean latency   resent%s\n",
+         s->cwndreported ? "  cwnd A" : "");
+  for (i = 0; i < s->nflows; i++) {
+    f = &s->flows[i];
+    printf("%9d %10d %9.4f %13.3f %8d", i, f->delivered, s->time > 0 ? f->delivered / s->time : 0.0,
+           f->delivered > 0 ? f->latencysum / f->delivered : 0.0, f->pstats.packets_resent);
+    if (s->cwndreported)
+      printf(" %7.2f", f->cwnd[A]);
+    printf("\n");
+  }
+  printf("fairness of the flows (Jain's index of the messages delivered):  %f\n\n", fairness(s));
+}
+
+/* table of the statinterval= windows */
+static void printwindows(struct sim *s)
+{
+  struct statwindow *w;
+  float cwnd[2] = { 0.0, 0.0 };
+  int i;
+
+  printf("\n    start  accepted  delivered   goodput  mean latency  packets  util A->B  util B->A%s\n",
+         s->cwndreported ? "  cwnd A  cwnd B" : "");
+  for (i = 0; i < s->nwindows; i++) {
+    w = &s->windows[i];
+    printf("%9.1f %9d %10d %9.4f %13.3f %8d %9.1f%% %9.1f%%", i * s->statinterval,
+           w->accepted, w->delivered, w->delivered / s->statinterval,
+           w->delivered > 0 ? w->latencysum / w->delivered : 0.0, w->sent,
+           100.0 * w->busy[B] / s->statinterval, 100.0 * w->busy[A] / s->statinterval);
+    if (s->cwndreported) {   /* the window at the end of the interval */
+      if (w->cwnd[A] > 0)
+        cwnd[A] = w->cwnd[A];
+      if (w->cwnd[B] > 0)
+        cwnd[B] = w->cwnd[B];
+      printf(" %7.2f %7.2f", cwnd[A], cwnd[B]);
+    }
+    printf("\n");
   }
+  printf("\n");
+}
 
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+void sim_report(struct sim *s)
+{
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",s->time,s->nsim);
+  printf("number of messages dropped due to full window:  %d \n", s->pstats.window_full);
+  if (s->pstats.messages_queued > 0)
+    printf("number of messages queued for a full window:  %d (peak %d, mean wait %f, max wait %f, mean depth %f)\n",
+           s->pstats.messages_queued, s->pstats.queue_peak,
+           s->pstats.queue_delay_sum / s->pstats.messages_queued, s->pstats.queue_delay_max,
+           s->time > 0 ? s->pstats.queue_delay_sum / s->time : 0.0);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", s->pstats.new_ACKs);
   printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  printf("number of packet resends by A:  %d \n", s->pstats.packets_resent);
+  if (s->pstats.fast_retransmits > 0)
+    printf("number of fast retransmits (duplicate ACKs) by A:  %d \n", s->pstats.fast_retransmits);
+  printf("number of correct packets received at B:  %d \n", s->pstats.packets_received);
+  printf("number of ACKs sent by B:  %d (%.2f per correct packet received)\n", s->pstats.acks_sent,
+         s->pstats.packets_received > 0 ? (double)s->pstats.acks_sent / s->pstats.packets_received : 0.0);
+  if (s->pstats.acks_piggybacked > 0)
+    printf("number of held back ACKs sent along with data:  %d \n", s->pstats.acks_piggybacked);
+  printf("number of messages delivered to application:  %d \n", s->messages_delivered);
+  printf("peak event pool size:  %d events (%d slabs of %d)\n", s->peakevents, s->nslabs, EVENTS_PER_SLAB);
+  printf("message latency from layer 5 to layer 5:  mean %f  p50 %f  p90 %f  p99 %f  max %f \n",
+         s->nlatencies > 0 ? s->latencysum / s->nlatencies : 0.0, latpercentile(s, 0.50),
+         latpercentile(s, 0.90), latpercentile(s, 0.99), s->latencymax);
+  printf("goodput:  %f messages per time unit \n", s->time > 0 ? s->messages_delivered / s->time : 0.0);
+  if (s->cwndreported)
+    printf("congestion window at the end:  A %.2f  B %.2f\n", s->cwnd[A], s->cwnd[B]);
+  if (s->linkmodel)
+    printf("packets dropped by the link queues:  %d (%d early by RED)\n", s->nlinkdrops, s->nreddrops);
+  if (s->lossmodel != LOSS_BERNOULLI)
+    printf("packets lost in the channels:  %d in %d bursts (mean %.2f in a row)\n", s->nlost, s->nlossbursts,
+           s->nlossbursts > 0 ? (double)s->nlost / s->nlossbursts : 0.0);
+  if (s->reorder > 0)
+    printf("packets held up so that later ones can overtake them:  %d \n", s->nreordered);
+  printf("channel utilisation:  A->B %.1f%%  B->A %.1f%% \n",
+         s->time > 0 ? 100.0 * s->busy[B] / s->time : 0.0,
+         s->time > 0 ? 100.0 * s->busy[A] / s->time : 0.0);
+  if (s->nflows > 1)
+    printflows(s);
+  if (s->statinterval > 0)
+    printwindows(s);
+  printstats(s);
+}
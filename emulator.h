@@ -1,20 +1,74 @@
+#include <stddef.h>
+
+/* building with -DTRACE_LEVEL=n makes the trace level a constant, */
+/* so the compiler removes every trace branch above level n        */
+#ifdef TRACE_LEVEL
+#define TRACE TRACE_LEVEL
+#else
 extern int TRACE;
+#endif
+
+/* statistics updated by GBN, one set per simulation */
+struct protocol_stats {
+  int total_ACKs_received;
+  int packets_resent;       /* count of the number of packets resent  */
+  int new_ACKs;      /* count of the number of acks correctly received */
+  int packets_received;  /* count of the packets received by receiver */
+  int window_full; /* count of the number of messages dropped due to full window */
+  int messages_queued;      /* messages that waited for room in the window */
+  int queue_peak;           /* most messages waiting at once */
+  double queue_delay_sum;   /* total time messages spent waiting */
+  double queue_delay_max;
+  int queue_depth;          /* messages waiting right now */
+  int fast_retransmits;     /* retransmissions triggered by duplicate ACKs */
+  int acks_sent;            /* ACKs sent by the receiver */
+  int acks_piggybacked;     /* held back ACKs that went along with data instead */
+};
+
+/* the statistics of the simulation that is currently running */
+extern struct protocol_stats *protocol_stats(void);
+
+/* the protocol keeps all of its variables in one struct of         */
+/* protocol_state_size bytes.  The emulator allocates a zeroed copy */
+/* for every simulation before A_init() is called.                  */
+extern const size_t protocol_state_size;
+extern void *protocol_state(void);
+
+/* zeroed memory that is freed together with the protocol state.    */
+/* checkpoints (restore=) save the blocks as plain data.  Pointers    */
+/* into them may only be kept in the protocol state, and each one    */
+/* is registered with protocol_pointer(&field) once it is set, so a  */
+/* restore can move it to where the block is now.  The blocks hold   */
+/* no pointers.                                                      */
+extern void *protocol_alloc(size_t);
+extern void protocol_pointer(void *field);
 
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+/* the integer parameter key=N of this simulation, defvalue if it */
+/* was not given.  protocol_badoption() reports an unusable value  */
+/* and exits.                                                      */
+extern int protocol_option(const char *key, int defvalue);
+extern double protocol_float_option(const char *key, double defvalue);
+extern const char *protocol_string_option(const char *key, const char *defvalue);
+extern void protocol_badoption(const char *key, const char *why);
+
+/* the congestion window of AorB changed (cc.c).  It goes into the */
+/* evlog= trace and the statinterval= table.                      */
+extern void protocol_cwnd(int AorB, double cwnd, double ssthresh);
 
 #define   A    0
 #define   B    1
 
+/* payload=N sets the size of the data in every message and packet at   */
+/* run time, from 1 to MAXPAYLOAD bytes (20 by default).  Only the first */
+/* get_payload_size() bytes of data and payload are used.               */
+#define MAXPAYLOAD 9000
+extern int get_payload_size(void);
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
 struct msg {
-  char data[20];
+  char data[MAXPAYLOAD];
 };
 
 /* a packet is the data unit passed from layer 4 (students code) to layer */
@@ -24,17 +78,32 @@ struct pkt {
   int seqnum;
   int acknum;
   int checksum;
-  char payload[20];
+  char payload[MAXPAYLOAD];
 };
 
+/* bytes a packet with payloadsize bytes of payload takes up in an     */
+/* array of them: the header and that payload, rounded up so the next */
+/* packet's header is aligned.  Window buffers are made of these, not */
+/* of the MAXPAYLOAD bytes of a whole struct pkt.                     */
+#define PKT_SLOTBYTES(payloadsize) \
+  ((offsetof(struct pkt, payload) + (size_t)(payloadsize) + sizeof(int) - 1) / sizeof(int) * sizeof(int))
+
+/* messages and packets are passed by pointer.  The emulator copies the */
+/* packet given to tolayer3(), the packet given to A_input()/B_input()  */
+/* and the message given to A_output()/B_output() are only valid until  */
+/* that call returns.                                                   */
+
 /* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
+extern void tolayer3(int, const struct pkt *);
 
 /* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+extern void tolayer5(int, const char *);
 
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
 /* stop timer at A or B (int) */
 extern void stoptimer(int);               
+
+/* current simulation time, for protocols that keep their own timers */
+extern double get_sim_time(void);
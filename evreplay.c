@@ -0,0 +1,369 @@
+/* evreplay: offline analysis of a binary event trace written by the
+   emulator with evlog=FILE.
+
+   usage: evreplay FILE [key=value ...]
+     timeline      print every record as a line of text
+     cwnd          print only the congestion window changes, as lines of
+                   time,entity,cwnd,ssthresh
+     from=T to=T   limit the timeline to records in [T,T]
+     bucket=W      width of the one way delay histogram buckets [1.0]
+     entity=A|B    sender whose packets are followed [A]
+     flow=N        flow whose packets are followed, with flows=N [0]
+     reuse=N       a packet seen again after N newer packets from the same
+                   sender is a new packet, not a retransmission [26]
+
+   Packets are told apart by sender, seqnum, acknum and payload hash.
+   The emulator's messages repeat one of 26 letters, so once the sequence
+   numbers wrap the same key comes back for a different message; reuse=
+   is how far apart two sends must be for that to be assumed.  The record
+   counts are for all flows, everything else is for one. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "evtrace.h"
+
+#define A    0
+#define B    1
+
+#define NBUCKETS  64    /* delay histogram buckets, the last one is open ended */
+#define MAXTX     10    /* transmissions per packet histogram, the last is open ended */
+
+struct packet {
+  int used;
+  int32_t seqnum, acknum;
+  uint32_t datahash;
+  double firstsent;     /* time of the original transmission */
+  double delivered;     /* first intact arrival, < 0 until there is one */
+  int lastflags;        /* fate of the latest copy */
+  double lastarrival;   /* arrival of the latest copy */
+  long ordinal;         /* count of new packets when this one was first sent */
+  int ntx;              /* transmissions so far */
+};
+
+static struct packet *packets;
+static size_t npackets, maxpackets;
+
+static const char *typenames[] = {
+  "dispatch", "tolayer3", "tolayer5", "starttimer", "stoptimer", "cwnd"
+};
+
+static const char *evtypenames[] = {
+  "TIMER_INTERRUPT", "FROM_LAYER5", "FROM_LAYER3"
+};
+
+static void usage(void)
+{
+  printf("usage: evreplay FILE [timeline] [cwnd] [from=T] [to=T] [bucket=W] [entity=A|B] [flow=N] [reuse=N]\n");
+  exit(EXIT_FAILURE);
+}
+
+static uint32_t packethash(int32_t seqnum, int32_t acknum, uint32_t datahash)
+{
+  uint32_t h = datahash;
+
+  h = (h ^ (uint32_t)seqnum) * 16777619u;
+  h = (h ^ (uint32_t)acknum) * 16777619u;
+  return h;
+}
+
+static void growpackets(void);
+
+/* find the packet with this key, or the empty slot it would go in */
+static struct packet *lookup(int32_t seqnum, int32_t acknum, uint32_t datahash)
+{
+  size_t i;
+
+  if (2 * (npackets + 1) > maxpackets)
+    growpackets();
+  i = packethash(seqnum, acknum, datahash) & (maxpackets - 1);
+  while (packets[i].used && (packets[i].seqnum != seqnum ||
+         packets[i].acknum != acknum || packets[i].datahash != datahash))
+    i = (i + 1) & (maxpackets - 1);
+  return &packets[i];
+}
+
+static void growpackets(void)
+{
+  struct packet *old = packets;
+  size_t oldmax = maxpackets, i;
+
+  maxpackets = oldmax ? 2 * oldmax : 1024;
+  packets = calloc(maxpackets, sizeof(struct packet));
+  if (packets == NULL) {
+    printf("memory allocation for packet table failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < oldmax; i++)
+    if (old[i].used)
+      *lookup(old[i].seqnum, old[i].acknum, old[i].datahash) = old[i];
+  free(old);
+}
+
+static struct evrecord *readtrace(const char *filename, size_t *nrecords)
+{
+  struct evheader h;
+  struct evrecord *recs = NULL;
+  size_t n = 0, max = 0;
+  FILE *f;
+
+  if ((f = fopen(filename, "rb")) == NULL) {
+    printf("unable to open %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, EVTRACE_MAGIC, sizeof(h.magic)) != 0) {
+    printf("%s is not an event trace\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  if (h.version != EVTRACE_VERSION || h.recsize != sizeof(struct evrecord)) {
+    printf("%s has trace version %u with %u byte records, expected version %d with %d\n",
+           filename, (unsigned)h.version, (unsigned)h.recsize,
+           EVTRACE_VERSION, (int)sizeof(struct evrecord));
+    exit(EXIT_FAILURE);
+  }
+  for (;;) {
+    if (n == max) {
+      max = max ? 2 * max : 65536;
+      if ((recs = realloc(recs, max * sizeof(struct evrecord))) == NULL) {
+        printf("memory allocation for %s failed.\n", filename);
+        exit(EXIT_FAILURE);
+      }
+    }
+    n += fread(recs + n, sizeof(struct evrecord), max - n, f);
+    if (n < max)
+      break;
+  }
+  if (ferror(f)) {
+    printf("read error on %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  fclose(f);
+  *nrecords = n;
+  return recs;
+}
+
+static void printrecord(const struct evrecord *r)
+{
+  printf("%12.4f %c %-10s", r->time, r->entity == A ? 'A' : 'B',
+         r->type <= EVREC_CWND ? typenames[r->type] : "?");
+  switch (r->type) {
+  case EVREC_DISPATCH:
+    printf(" %s", r->evtype <= EVTYPE_FROM_LAYER3 ? evtypenames[r->evtype] : "?");
+    if (r->evtype == EVTYPE_FROM_LAYER3)
+      printf(" seq=%d ack=%d", (int)r->seqnum, (int)r->acknum);
+    else if (r->evtype == EVTYPE_FROM_LAYER5)
+      printf(" msg=%d", (int)r->seqnum);
+    break;
+  case EVREC_TOLAYER3:
+    printf(" seq=%d ack=%d", (int)r->seqnum, (int)r->acknum);
+    if (r->flags & EVREC_QUEUEDROP)
+      printf(" dropped");
+    else if (r->flags & EVREC_LOST)
+      printf(" lost");
+    else
+      printf(" arrives=%.4f%s%s", r->extra, r->flags & EVREC_CORRUPT ? " corrupt" : "",
+             r->flags & EVREC_REORDERED ? " reordered" : "");
+    break;
+  case EVREC_TOLAYER5:
+    printf(" msg=%d", (int)r->seqnum);
+    break;
+  case EVREC_STARTTIMER:
+    printf(" increment=%.4f", r->extra);
+    break;
+  case EVREC_CWND:
+    printf(" cwnd=%.3f ssthresh=%d", r->extra, (int)r->seqnum);
+    break;
+  }
+  if (r->flow > 0)
+    printf(" flow=%d", (int)r->flow);
+  printf("\n");
+}
+
+static void printhistogram(const char *title, const long *counts, int n, double width, int openended)
+{
+  long total = 0, peak = 0;
+  int i, last = -1;
+
+  for (i = 0; i < n; i++) {
+    total += counts[i];
+    if (counts[i] > peak)
+      peak = counts[i];
+    if (counts[i] > 0)
+      last = i;
+  }
+  printf("%s\n", title);
+  for (i = 0; i <= last; i++) {
+    if (width > 0.0 && i == n - 1 && openended)
+      printf("  %8.2f+         ", i * width);
+    else if (width > 0.0)
+      printf("  %8.2f-%-8.2f ", i * width, (i + 1) * width);
+    else
+      printf("  %3d%s ", i + 1, i == n - 1 && openended ? "+" : " ");
+    printf("%8ld %6.2f%% %.*s\n", counts[i], 100.0 * counts[i] / total,
+           (int)(40 * counts[i] / peak), "########################################");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  struct evrecord *recs, *r;
+  struct packet *p;
+  size_t nrecords, i;
+  const char *filename = NULL;
+  int timeline = 0, cwnd = 0, entity = A, flow = 0, lastdispatch = -1, j;
+  double from = -1.0, to = -1.0, bucket = 1.0, delay, delaysum = 0.0, maxdelay = 0.0;
+  double latencysum = 0.0, maxlatency = 0.0;
+  long reuse = 26, ordinal = 0, ndelays = 0, nlatencies = 0, ntx = 0;
+  long types[EVREC_CWND + 1], evtypes[EVTYPE_FROM_LAYER3 + 1];
+  long delays[NBUCKETS], txcounts[MAXTX];
+  long bytimeout = 0, byother = 0, prevlost = 0, prevcorrupt = 0, spurious = 0, inflight = 0;
+
+  for (j = 1; j < argc; j++) {
+    if (strcmp(argv[j], "timeline") == 0)
+      timeline = 1;
+    else if (strcmp(argv[j], "cwnd") == 0)
+      cwnd = 1;
+    else if (strncmp(argv[j], "from=", 5) == 0)
+      from = atof(argv[j] + 5);
+    else if (strncmp(argv[j], "to=", 3) == 0)
+      to = atof(argv[j] + 3);
+    else if (strncmp(argv[j], "bucket=", 7) == 0)
+      bucket = atof(argv[j] + 7);
+    else if (strncmp(argv[j], "reuse=", 6) == 0)
+      reuse = atol(argv[j] + 6);
+    else if (strcmp(argv[j], "entity=A") == 0)
+      entity = A;
+    else if (strcmp(argv[j], "entity=B") == 0)
+      entity = B;
+    else if (strncmp(argv[j], "flow=", 5) == 0)
+      flow = atoi(argv[j] + 5);
+    else if (strchr(argv[j], '=') == NULL && filename == NULL)
+      filename = argv[j];
+    else
+      usage();
+  }
+  if (filename == NULL || bucket <= 0.0 || reuse < 1 || flow < 0)
+    usage();
+
+  recs = readtrace(filename, &nrecords);
+  memset(types, 0, sizeof(types));
+  memset(evtypes, 0, sizeof(evtypes));
+  memset(delays, 0, sizeof(delays));
+  memset(txcounts, 0, sizeof(txcounts));
+  growpackets();
+
+  for (i = 0; i < nrecords; i++) {
+    r = &recs[i];
+    if (timeline && (from < 0.0 || r->time >= from) && (to < 0.0 || r->time <= to))
+      printrecord(r);
+    if (cwnd && r->type == EVREC_CWND && r->flow == flow && (from < 0.0 || r->time >= from) && (to < 0.0 || r->time <= to))
+      printf("%.4f,%c,%.3f,%d\n", r->time, r->entity == A ? 'A' : 'B', r->extra, (int)r->seqnum);
+    if (r->type > EVREC_CWND)
+      continue;
+    types[r->type]++;
+    if (r->type == EVREC_DISPATCH && r->evtype <= EVTYPE_FROM_LAYER3)
+      evtypes[r->evtype]++;
+    if (r->flow != flow)
+      continue;
+    if (r->type == EVREC_DISPATCH) {
+      lastdispatch = r->evtype;
+      continue;
+    }
+    if (r->type != EVREC_TOLAYER3)
+      continue;
+
+    /* one way delay of every packet that made it across */
+    if (!(r->flags & EVREC_LOST)) {
+      delay = r->extra - r->time;
+      delaysum += delay;
+      ndelays++;
+      if (delay > maxdelay)
+        maxdelay = delay;
+      j = (int)(delay / bucket);
+      delays[j < NBUCKETS ? j : NBUCKETS - 1]++;
+    }
+
+    /* follow the packets of one sender through their retransmissions */
+    if (r->entity != entity)
+      continue;
+    ntx++;
+    p = lookup(r->seqnum, r->acknum, r->datahash);
+    if (p->used && ordinal - p->ordinal < reuse) {
+      if (lastdispatch == EVTYPE_TIMER_INTERRUPT)
+        bytimeout++;
+      else
+        byother++;
+      if (p->lastflags & EVREC_LOST)
+        prevlost++;
+      else if (p->lastflags & EVREC_CORRUPT)
+        prevcorrupt++;
+      else if (p->lastarrival <= r->time)
+        spurious++;
+      else
+        inflight++;
+      p->ntx++;
+    }
+    else {
+      if (p->used)
+        txcounts[p->ntx < MAXTX ? p->ntx - 1 : MAXTX - 1]++;
+      else
+        npackets++;
+      p->used = 1;
+      p->seqnum = r->seqnum;
+      p->acknum = r->acknum;
+      p->datahash = r->datahash;
+      p->firstsent = r->time;
+      p->delivered = -1.0;
+      p->ordinal = ordinal++;
+      p->ntx = 1;
+    }
+    p->lastflags = r->flags;
+    p->lastarrival = r->extra;
+    if (p->delivered < 0.0 && !(r->flags & (EVREC_LOST | EVREC_CORRUPT))) {
+      p->delivered = r->extra;
+      delay = p->delivered - p->firstsent;
+      latencysum += delay;
+      nlatencies++;
+      if (delay > maxlatency)
+        maxlatency = delay;
+    }
+  }
+  if (cwnd) {
+    free(recs);
+    free(packets);
+    return 0;
+  }
+  for (i = 0; i < maxpackets; i++)
+    if (packets[i].used)
+      txcounts[packets[i].ntx < MAXTX ? packets[i].ntx - 1 : MAXTX - 1]++;
+
+  printf("%s: %lu records, simulation time %f\n", filename, (unsigned long)nrecords,
+         nrecords > 0 ? recs[nrecords - 1].time : 0.0);
+  for (j = 0; j <= EVREC_CWND; j++)
+    if (j != EVREC_CWND || types[j] > 0)
+      printf("  %-12s %ld\n", typenames[j], types[j]);
+  for (j = 0; j <= EVTYPE_FROM_LAYER3; j++)
+    printf("    %-16s %ld\n", evtypenames[j], evtypes[j]);
+
+  printf("\none way delay of %ld packets not lost: mean %f max %f\n", ndelays,
+         ndelays ? delaysum / ndelays : 0.0, maxdelay);
+  if (ndelays > 0)
+    printhistogram("delay histogram:", delays, NBUCKETS, bucket, 1);
+
+  printf("\npackets sent by %c: %ld original, %ld retransmissions\n", entity == A ? 'A' : 'B',
+         ntx - (bytimeout + byother), bytimeout + byother);
+  printf("  triggered by a timeout        %ld\n", bytimeout);
+  printf("  triggered by anything else    %ld\n", byother);
+  printf("  previous copy lost            %ld\n", prevlost);
+  printf("  previous copy corrupted       %ld\n", prevcorrupt);
+  printf("  spurious, previous copy got there intact  %ld\n", spurious);
+  printf("  previous copy still in flight %ld\n", inflight);
+  printf("first send to first intact arrival: %ld packets, mean %f max %f\n", nlatencies,
+         nlatencies ? latencysum / nlatencies : 0.0, maxlatency);
+  if (ntx > 0)
+    printhistogram("transmissions per packet:", txcounts, MAXTX, 0.0, 1);
+
+  free(recs);
+  free(packets);
+  return 0;
+}
@@ -0,0 +1,47 @@
+/* Binary event trace written by the emulator with evlog=FILE and read
+   back by evreplay.  The file is an evheader followed by fixed size
+   evrecords, all in the byte order of the machine that wrote them. */
+
+#include <stdint.h>
+
+#define EVTRACE_MAGIC   "EVTR"
+#define EVTRACE_VERSION 1
+
+struct evheader {
+  char magic[4];               /* EVTRACE_MAGIC */
+  uint32_t version;            /* EVTRACE_VERSION */
+  uint32_t recsize;            /* sizeof(struct evrecord) */
+  uint32_t reserved;
+};
+
+/* record types */
+#define EVREC_DISPATCH   0     /* main loop dispatches an event, evtype says which */
+#define EVREC_TOLAYER3   1     /* entity hands a packet to layer 3 */
+#define EVREC_TOLAYER5   2     /* entity delivers data to layer 5 */
+#define EVREC_STARTTIMER 3     /* extra is the timer increment */
+#define EVREC_STOPTIMER  4
+#define EVREC_CWND       5     /* extra is the congestion window, seqnum ssthresh rounded down */
+
+/* evtype of EVREC_DISPATCH records, the emulator's event type codes */
+#define EVTYPE_TIMER_INTERRUPT 0
+#define EVTYPE_FROM_LAYER5     1
+#define EVTYPE_FROM_LAYER3     2
+
+/* flags of EVREC_TOLAYER3 records */
+#define EVREC_LOST       0x01
+#define EVREC_CORRUPT    0x02
+#define EVREC_QUEUEDROP  0x04  /* with EVREC_LOST: dropped by the link queue */
+#define EVREC_REORDERED  0x08  /* held up on the way, later packets may overtake it */
+
+struct evrecord {
+  double time;                 /* simulation time of the record */
+  double extra;                /* TOLAYER3: arrival time, STARTTIMER: increment, CWND: cwnd */
+  int32_t seqnum;              /* packet fields, or the message number for a */
+  int32_t acknum;              /* dispatched FROM_LAYER5 event */
+  uint32_t datahash;           /* FNV-1a hash of the payload, tells packets apart */
+  uint8_t type;                /* EVREC_* */
+  uint8_t entity;              /* A or B */
+  uint8_t flags;               /* EVREC_LOST, EVREC_CORRUPT, EVREC_QUEUEDROP, EVREC_REORDERED */
+  uint8_t evtype;              /* DISPATCH: the emulator's event type code */
+  uint16_t flow;               /* flows=N: the flow, fills what was padding */
+};
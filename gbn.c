@@ -1,8 +1,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "emulator.h"
 #include "gbn.h"
+#include "rto.h"
+#include "msgqueue.h"
+#include "checksum.h"
+#include "cc.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -20,256 +25,630 @@
    - removed bidirectional GBN code and other code not used by prac.
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - the timeout adapts to the measured round trip time (rto.c), RTT is
+   only the timeout used before the first measurement
+   - window=N and seqspace=N set the window and sequence space at run
+   time, the buffers are sized to match
+   - with queue=N up to N messages that find the window full wait in a
+   FIFO and are sent as ACKs make room, instead of being dropped
+   - dupthresh=N duplicate ACKs in a row resend the window without waiting
+   for the timeout (fast retransmit), dupthresh=0 turns that off
+   - ackdelay=T makes B hold the ACK of an in-order packet for up to T
+   time units, so that one cumulative ACK covers ackevery=N packets
+   - bidirectional=1 makes B send messages too.  A and B then both run a
+   sender and a receiver, every data packet carries the cumulative ACK
+   for the other direction, and a separate ACK is only sent if no data
+   has taken it along within ackdelay (ACKDELAY by default)
+   - pure ACKs carry seqnum NOTINUSE so they can be told from data
+   - checksum=inet or crc32c replaces the byte sum (checksum.c)
+   - messages and packets are passed by pointer and their payload is
+   copied once, into the window buffer, with only get_payload_size()
+   bytes being used
+   - cc=1 adds congestion control (cc.c): only the first cwnd packets of
+   the window are in flight, the rest wait until ACKs make room
 **********************************************************************/
 
-#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet
+#define RTT  16.0       /* initial timeout.  MUST BE SET TO 16.0 when submitting assignment */
+#define WINDOWSIZE 6    /* default maximum number of buffered unacked packet
                           MUST BE SET TO 6 when submitting assignment */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define DUPTHRESH 3     /* default number of duplicate ACKs that trigger a fast retransmit */
+#define ACKEVERY 2      /* default number of packets a delayed ACK covers at most */
+#define ACKDELAY 5.0    /* default time an ACK waits for reverse data with bidirectional=1 */
+#define TIMER_SLACK 0.001  /* a logical timer this close to expiry counts as expired */
+
+/* one end of the connection.  Both run the same code, but unless the
+   run is bidirectional A only sends data and B only sends ACKs */
+struct endpoint {
+  /* sender variables */
+  char *buffer;                   /* slots for storing packets waiting for ACK, see Slot() */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int nextseqnum;                 /* the next sequence number to be used by the sender */
+  double *sendtime;               /* when each packet in the window was first sent */
+  bool *resent;                   /* has it been sent again since? (Karn's rule) */
+  int dupacks;                    /* duplicate ACKs since the last new one */
+  int nsent;                      /* packets of the window sent since the last go back */
+  int nsentmax;                   /* packets of the window that were ever sent */
+  struct cc cc;                   /* congestion window, if gbn->cc */
+  struct msgqueue queue;          /* messages waiting for room in the window */
+  struct rto rto;                 /* retransmission timeout estimator */
+  double timeout;                 /* when the oldest packet in the window is resent */
+
+  /* receiver variables */
+  int expectedseqnum;             /* the sequence number expected next by the receiver */
+  int pendingacks;                /* in-order packets received whose ACK is held back */
+  double acktime;                 /* when the held back ACK has to go out */
+
+  /* the emulator's timer serves both the timeout and the held back ACK */
+  bool timerrunning;
+  double timerexpiry;
+};
+
+/* all protocol variables, one copy per simulation (see protocol_state()) */
+struct gbn {
+  /* parameters */
+  int windowsize;                 /* the maximum number of buffered unacked packets */
+  int windowmask;                 /* buffer size - 1, the buffer size is a power of 2 */
+  int seqspace;                   /* number of sequence numbers */
+  int seqmask;                    /* seqspace - 1 if that is a power of 2, else 0 */
+  int dupthresh;                  /* duplicate ACKs before a fast retransmit, 0 = never */
+  int checksum;                   /* enum checksum_kind */
+  bool bidirectional;             /* B sends data to A as well */
+  double ackdelay;                /* longest time an ACK is held back, 0 = ACK every packet at once */
+  int ackevery;                   /* a held back ACK is sent once it covers this many packets */
+  int payloadsize;                /* bytes of data in a message or packet */
+  size_t pktbytes;                /* bytes of a packet stored in a buffer */
+  bool cc;                        /* congestion control limits the packets in flight */
+
+  struct pkt *ackpkt;             /* separate ACKs are built here, the payload is all '0's */
+  struct endpoint ep[2];          /* A and B */
+};
+
+const size_t protocol_state_size = sizeof(struct gbn);
+
+#define NAME(AorB) ((AorB) == A ? 'A' : 'B')
+
+/* the packet in slot i of the window buffer, the slots are PKT_SLOTBYTES() apart */
+static struct pkt *Slot(const struct gbn *gbn, const struct endpoint *ep, int i)
+{
+  return (struct pkt *)(ep->buffer + (size_t)i * gbn->pktbytes);
+}
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
+   the packet is corrupted.  checksum=KIND chooses the algorithm, see checksum.c
 */
-int ComputeChecksum(struct pkt packet)
+int ComputeChecksum(const struct pkt *packet)
 {
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ )
-    checksum += (int)(packet.payload[i]);
+  const struct gbn *gbn = protocol_state();
 
-  return checksum;
+  return checksum_packet(gbn->checksum, packet, gbn->payloadsize);
 }
 
-bool IsCorrupted(struct pkt packet)
+bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
 }
 
 
-/********* Sender (A) variables and functions ************/
+/* sequence number n places after seq, n >= 0 */
+static int SeqAdd(const struct gbn *gbn, int seq, int n)
+{
+  if (gbn->seqmask)
+    return (seq + n) & gbn->seqmask;
+  return (seq + n) % gbn->seqspace;
+}
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+/* run the emulator's timer of AorB until the earlier of its logical timers,
+   the retransmission timeout and the deadline of a held back ACK */
+static void SetTimer(int AorB)
+{
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
+  double now = get_sim_time();
+  double expiry = 0.0;
+  bool pending = false;
+
+  if (ep->windowcount > 0) {
+    expiry = ep->timeout;
+    pending = true;
+  }
+  if (ep->pendingacks > 0 && (!pending || ep->acktime < expiry)) {
+    expiry = ep->acktime;
+    pending = true;
+  }
+  if (ep->timerrunning && (!pending || expiry != ep->timerexpiry)) {
+    stoptimer(AorB);
+    ep->timerrunning = false;
+  }
+  if (pending && !ep->timerrunning) {
+    starttimer(AorB, expiry > now ? expiry - now : 0.0);
+    ep->timerrunning = true;
+    ep->timerexpiry = expiry;
+  }
+}
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+/* the cumulative ACK AorB's receiver sends: the last packet received in order */
+static int AckNum(const struct gbn *gbn, int AorB)
 {
-  struct pkt sendpkt;
+  return SeqAdd(gbn, gbn->ep[AorB].expectedseqnum, gbn->seqspace - 1);
+}
+
+/* send a data packet, with the current ACK of the reverse direction if there is one */
+static void SendData(int AorB, struct pkt *packet)
+{
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
+
+  if (gbn->bidirectional) {
+    packet->acknum = AckNum(gbn, AorB);
+    if (ep->pendingacks > 0) {
+      protocol_stats()->acks_piggybacked++;
+      ep->pendingacks = 0;
+    }
+  }
+  packet->checksum = ComputeChecksum(packet);
+  tolayer3(AorB, packet);
+}
+
+/********* Sender variables and functions ************/
+
+/* the number of packets AorB may have in flight */
+static int SendWindow(const struct gbn *gbn, int AorB)
+{
+  if (gbn->cc)
+    return cc_window(&gbn->ep[AorB].cc);
+  return gbn->windowsize;
+}
+
+/* send the packets of the window that are not in flight, as far as the
+   congestion window allows.  Without congestion control that is every
+   packet, as soon as it enters the window or the window goes back */
+static void SendPending(int AorB)
+{
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
   int i;
 
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+  while (ep->nsent < ep->windowcount && ep->nsent < SendWindow(gbn, AorB)) {
+    i = (ep->windowfirst + ep->nsent) & gbn->windowmask;
+    if (ep->nsent < ep->nsentmax) {
+      if (TRACE > 0)
+        printf ("---%c: resending packet %d\n", NAME(AorB), Slot(gbn, ep, i)->seqnum);
+      protocol_stats()->packets_resent++;
+      ep->resent[i] = true;
+    }
+    else {
+      if (TRACE > 0)
+        printf("Sending packet %d to layer 3\n", Slot(gbn, ep, i)->seqnum);
+      ep->sendtime[i] = get_sim_time();
+      ep->resent[i] = false;
+      ep->nsentmax++;
+    }
+    SendData(AorB, Slot(gbn, ep, i));
+    ep->nsent++;
+  }
+}
+
+/* put a message in the window and send it if the congestion window allows,
+   the window must have room */
+static void SendMessage(int AorB, const struct msg *message)
+{
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
+  struct pkt *sendpkt;
+
+  /* create packet in its place in the window buffer */
+  /* windowlast will always be 0 for alternating bit; but not for GoBackN */
+  ep->windowlast = (ep->windowlast + 1) & gbn->windowmask;
+  sendpkt = Slot(gbn, ep, ep->windowlast);
+  sendpkt->seqnum = ep->nextseqnum;
+  sendpkt->acknum = NOTINUSE;
+  memcpy(sendpkt->payload, message->data, gbn->payloadsize);
+  ep->windowcount++;
+
+  /* send out packet */
+  SendPending(AorB);
+
+  /* start timer if first packet in window */
+  if (ep->windowcount == 1)
+    ep->timeout = get_sim_time() + ep->rto.rto;
+  SetTimer(AorB);
+
+  /* get next sequence number, wrap back to 0 */
+  ep->nextseqnum = SeqAdd(gbn, ep->nextseqnum, 1);
+}
+
+/* send queued messages while the window has room */
+static void DrainQueue(int AorB)
+{
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
+  struct msg message;
+
+  while (ep->windowcount < SendWindow(gbn, AorB) && msgqueue_get(&ep->queue, &message)) {
     if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for ( i=0; i<20 ; i++ )
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+      printf("----%c: window has room, send queued message to layer3!\n", NAME(AorB));
+    SendMessage(AorB, &message);
+  }
+}
 
-    /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+static void Output(int AorB, const struct msg *message)
+{
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
 
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+  /* if not blocked waiting on ACK, and no older message is waiting */
+  if ( ep->windowcount < SendWindow(gbn, AorB) && ep->queue.count == 0) {
+    if (TRACE > 1)
+      printf("----%c: New message arrives, send window is not full, send new messge to layer3!\n", NAME(AorB));
+    SendMessage(AorB, message);
+  }
+  /* if blocked, the message waits in the queue if there is room */
+  else if (msgqueue_put(&ep->queue, message)) {
+    if (TRACE > 0)
+      printf("----%c: New message arrives, send window is full, message queued\n", NAME(AorB));
   }
-  /* if blocked,  window is full */
+  /* window and queue are full */
   else {
     if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
+      printf("----%c: New message arrives, send window is full\n", NAME(AorB));
+    protocol_stats()->window_full++;
   }
 }
 
+void A_output(const struct msg *message)
+{
+  Output(A, message);
+}
 
-/* called from layer 3, when a packet arrives for layer 4
-   In this practical this will always be an ACK as B never sends data.
-*/
-void A_input(struct pkt packet)
+
+/* go back: resend the packets in the window, as far as the congestion
+   window allows, and restart the timeout */
+static void ResendWindow(int AorB)
+{
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
+
+  ep->nsent = 0;
+  SendPending(AorB);
+  ep->timeout = get_sim_time() + ep->rto.rto;
+}
+
+/* an uncorrupted ACK arrived at AorB, on its own or piggybacked on data */
+static void AckInput(int AorB, int acknum, bool piggybacked)
 {
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
   int ackcount = 0;
   int i;
 
-  /* if received ACK is not corrupted */
-  if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-    total_ACKs_received++;
-
-    /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
-          /* check case when seqnum has and hasn't wrapped */
-          if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-              ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
-
-            /* packet is a new ACK */
-            if (TRACE > 0)
-              printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-            new_ACKs++;
-
-            /* cumulative acknowledgement - determine how many packets are ACKed */
-            if (packet.acknum >= seqfirst)
-              ackcount = packet.acknum + 1 - seqfirst;
-            else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
-
-	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
-
-            /* delete the acked packets from window buffer */
-            for (i=0; i<ackcount; i++)
-              windowcount--;
-
-	    /* start timer again if there are still more unacked packets in window */
-            stoptimer(A);
-            if (windowcount > 0)
-              starttimer(A, RTT);
-
-          }
-        }
-        else
-          if (TRACE > 0)
-        printf ("----A: duplicate ACK received, do nothing!\n");
+  if (TRACE > 0)
+    printf("----%c: uncorrupted ACK %d is received\n", NAME(AorB), acknum);
+  protocol_stats()->total_ACKs_received++;
+
+  /* check if new ACK or duplicate */
+  if (ep->windowcount != 0) {
+    int seqfirst = Slot(gbn, ep, ep->windowfirst)->seqnum;
+    int seqlast = Slot(gbn, ep, ep->windowlast)->seqnum;
+    /* check case when seqnum has and hasn't wrapped */
+    if (((seqfirst <= seqlast) && (acknum >= seqfirst && acknum <= seqlast)) ||
+        ((seqfirst > seqlast) && (acknum >= seqfirst || acknum <= seqlast))) {
+
+      /* packet is a new ACK */
+      if (TRACE > 0)
+        printf("----%c: ACK %d is not a duplicate\n", NAME(AorB), acknum);
+      protocol_stats()->new_ACKs++;
+      ep->dupacks = 0;
+
+      /* cumulative acknowledgement - determine how many packets are ACKed */
+      ackcount = SeqAdd(gbn, acknum + gbn->seqspace - seqfirst, 1);
+
+      /* measure the round trip of the packet that caused this ACK,
+         unless it was retransmitted and the ACK could be for either copy */
+      i = (ep->windowfirst + ackcount - 1) & gbn->windowmask;
+      if (!ep->resent[i])
+        rto_sample(&ep->rto, get_sim_time() - ep->sendtime[i]);
+
+      /* slide window by the number of packets ACKed */
+      ep->windowfirst = (ep->windowfirst + ackcount) & gbn->windowmask;
+
+      /* delete the acked packets from window buffer */
+      for (i=0; i<ackcount; i++)
+        ep->windowcount--;
+      ep->nsent = ep->nsent > ackcount ? ep->nsent - ackcount : 0;
+      ep->nsentmax = ep->nsentmax > ackcount ? ep->nsentmax - ackcount : 0;
+
+      /* the congestion window grows, send what it allows now */
+      if (gbn->cc)
+        cc_ack(&ep->cc, ackcount);
+      SendPending(AorB);
+
+      /* start timer again if there are still more unacked packets in window */
+      ep->timeout = get_sim_time() + ep->rto.rto;
+      SetTimer(AorB);
+
+      /* the window has room again for queued messages */
+      DrainQueue(AorB);
+
+    }
+    /* the other side acknowledged the packet before the window again, so a
+       packet in the window went missing and it is discarding the ones after
+       it.  Data always carries the latest ACK, so only separate ACKs count */
+    else if (!piggybacked && acknum == SeqAdd(gbn, seqfirst, gbn->seqspace - 1)) {
+      ep->dupacks++;
+      if (TRACE > 0)
+        printf ("----%c: duplicate ACK %d received (%d in a row)\n", NAME(AorB), acknum, ep->dupacks);
+      /* not if the window has been resent already: the other side ACKs
+         every copy it did not need, and those look just the same */
+      if (gbn->dupthresh > 0 && ep->dupacks == gbn->dupthresh && !ep->resent[ep->windowfirst]) {
+        if (TRACE > 0)
+          printf("----%c: fast retransmit, resend packets!\n", NAME(AorB));
+        protocol_stats()->fast_retransmits++;
+        if (gbn->cc)
+          cc_fastretransmit(&ep->cc, ep->nsent, gbn->dupthresh);
+        ResendWindow(AorB);
+        SetTimer(AorB);
+      }
+      /* every further duplicate means a packet left the network (fast recovery) */
+      else if (gbn->cc && ep->dupacks > gbn->dupthresh && gbn->dupthresh > 0) {
+        cc_dupack(&ep->cc);
+        SendPending(AorB);
+      }
+    }
   }
   else
     if (TRACE > 0)
-      printf ("----A: corrupted ACK is received, do nothing!\n");
+      printf ("----%c: duplicate ACK received, do nothing!\n", NAME(AorB));
 }
 
-/* called when A's timer goes off */
-void A_timerinterrupt(void)
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void A_init(void)
 {
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep;
+  int bufsize = 1;
+  int queue;
   int i;
 
-  if (TRACE > 0)
-    printf("----A: time out,resend packets!\n");
-
-  for(i=0; i<windowcount; i++) {
-
-    if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
-
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
-    packets_resent++;
-    if (i==0) starttimer(A,RTT);
+  /* parameters, B_init() relies on A_init() being called first */
+  gbn->windowsize = protocol_option("window", WINDOWSIZE);
+  if (gbn->windowsize < 1)
+    protocol_badoption("window", "the window must hold at least one packet");
+  gbn->seqspace = protocol_option("seqspace", gbn->windowsize + 1);   /* the GBN minimum */
+  if (gbn->seqspace < gbn->windowsize + 1)
+    protocol_badoption("seqspace", "GBN needs at least window + 1 sequence numbers");
+  gbn->seqmask = (gbn->seqspace & (gbn->seqspace - 1)) == 0 ? gbn->seqspace - 1 : 0;
+
+  /* messages that find the window full wait here, by default they are dropped */
+  queue = protocol_option("queue", 0);
+  if (queue < 0)
+    protocol_badoption("queue", "the queue cannot hold fewer than 0 messages");
+
+  gbn->dupthresh = protocol_option("dupthresh", DUPTHRESH);
+  if (gbn->dupthresh < 0)
+    protocol_badoption("dupthresh", "use 0 to turn fast retransmit off");
+
+  gbn->checksum = checksum_kind(protocol_string_option("checksum", "sum"));
+  if (gbn->checksum < 0)
+    protocol_badoption("checksum", "use sum, inet or crc32c");
+
+  gbn->bidirectional = protocol_option("bidirectional", BIDIRECTIONAL) != 0;
+  gbn->ackdelay = protocol_float_option("ackdelay", gbn->bidirectional ? ACKDELAY : 0.0);
+  if (gbn->ackdelay < 0)
+    protocol_badoption("ackdelay", "use 0 to ACK every packet at once");
+  gbn->ackevery = protocol_option("ackevery", ACKEVERY);
+  if (gbn->ackevery < 1)
+    protocol_badoption("ackevery", "an ACK covers at least one packet");
+  gbn->cc = protocol_option("cc", 0) != 0;
+
+  /* we don't have any data to send with a separate ACK.  fill payload with 0's */
+  gbn->payloadsize = get_payload_size();
+  gbn->pktbytes = PKT_SLOTBYTES(gbn->payloadsize);
+  gbn->ackpkt = protocol_alloc(gbn->pktbytes);
+  protocol_pointer(&gbn->ackpkt);
+  memset(gbn->ackpkt->payload, '0', gbn->payloadsize);
+
+  /* the buffer is a ring of a power of 2 packets so indexes wrap with a mask */
+  while (bufsize < gbn->windowsize)
+    bufsize *= 2;
+  gbn->windowmask = bufsize - 1;
+
+  /* initialise both senders' window, buffer and sequence number, B's
+     is only used if the run is bidirectional.  The pointers to the
+     buffers are registered so restore= can move them */
+  for (i = A; i <= B; i++) {
+    ep = &gbn->ep[i];
+    ep->buffer = protocol_alloc(bufsize * gbn->pktbytes);
+    protocol_pointer(&ep->buffer);
+    ep->sendtime = protocol_alloc(bufsize * sizeof(double));
+    protocol_pointer(&ep->sendtime);
+    ep->resent = protocol_alloc(bufsize * sizeof(bool));
+    protocol_pointer(&ep->resent);
+    msgqueue_init(&ep->queue, queue);
+    ep->nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+    ep->windowfirst = 0;
+    ep->windowlast = -1;   /* windowlast is where the last packet sent is stored.
+                       new packets are placed in winlast + 1
+                       so initially this is set to -1
+                     */
+    ep->windowcount = 0;
+    ep->nsent = 0;
+    ep->nsentmax = 0;
+    if (gbn->cc && (i == A || gbn->bidirectional))
+      cc_init(&ep->cc, i, gbn->windowsize);
+    rto_init(&ep->rto, RTT);
+    /* the timer has to allow for the ACKs that the other side holds back */
+    rto_ackdelay(&ep->rto, gbn->ackdelay);
+    ep->timerrunning = false;
   }
 }
 
 
 
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
-{
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.
-		     new packets are placed in winlast + 1
-		     so initially this is set to -1
-		   */
-  windowcount = 0;
-}
+/********* Receiver variables and procedures ************/
 
 
+/* send a separate cumulative ACK, it covers any ACKs being held back */
+static void SendAck(int AorB)
+{
+  struct gbn *gbn = protocol_state();
+  struct pkt *sendpkt = gbn->ackpkt;   /* the payload is filled in by A_init() */
 
-/********* Receiver (B)  variables and procedures ************/
+  /* create packet */
+  sendpkt->seqnum = NOTINUSE;        /* not data, see DataInput() */
+  sendpkt->acknum = AckNum(gbn, AorB);
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+  /* computer checksum */
+  sendpkt->checksum = ComputeChecksum(sendpkt);
 
+  /* send out packet */
+  tolayer3 (AorB, sendpkt);
+  protocol_stats()->acks_sent++;
 
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+  gbn->ep[AorB].pendingacks = 0;
+}
+
+/* an uncorrupted data packet arrived at AorB */
+static void DataInput(int AorB, const struct pkt *packet)
 {
-  struct pkt sendpkt;
-  int i;
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
 
-  /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  /* if received packet is in order */
+  if (packet->seqnum == ep->expectedseqnum) {
     if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
+      printf("----%c: packet %d is correctly received, send ACK!\n", NAME(AorB), packet->seqnum);
+    protocol_stats()->packets_received++;
 
     /* deliver to receiving application */
-    tolayer5(B, packet.payload);
-
-    /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    tolayer5(AorB, packet->payload);
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+    ep->expectedseqnum = SeqAdd(gbn, ep->expectedseqnum, 1);
+
+    /* send an ACK for the received packet, or hold it back to cover the next
+       one too or to go along with data */
+    if (gbn->ackdelay > 0 && ++ep->pendingacks < gbn->ackevery) {
+      if (TRACE > 0)
+        printf("----%c: ACK %d held back\n", NAME(AorB), packet->seqnum);
+      if (ep->pendingacks == 1)
+        ep->acktime = get_sim_time() + gbn->ackdelay;
+    }
+    else
+      SendAck(AorB);
   }
   else {
-    /* packet is corrupted or out of order resend last ACK */
+    /* packet is out of order, resend last ACK at once, the sender counts these */
     if (TRACE > 0)
-      printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
-    else
-      sendpkt.acknum = expectedseqnum - 1;
+      printf("----%c: packet not expected sequence number, resend ACK!\n", NAME(AorB));
+    SendAck(AorB);
+  }
+  SetTimer(AorB);
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at AorB.  Unless
+   the run is bidirectional this is an ACK at A and a data packet at B */
+static void Input(int AorB, const struct pkt *packet)
+{
+  struct gbn *gbn = protocol_state();
+
+  if (IsCorrupted(packet)) {
+    /* B resends the last ACK at once, A counts these.  If both sides send
+       data the packet may just as well have been an ACK, and answering that
+       would make the other side count a duplicate that is not one, so the
+       next data packet that arrives out of order has to do it instead */
+    if (AorB == B && !gbn->bidirectional) {
+      if (TRACE > 0)
+        printf("----%c: packet corrupted, resend ACK!\n", NAME(AorB));
+      SendAck(AorB);
+      SetTimer(AorB);
+    }
+    else if (TRACE > 0)
+      printf ("----%c: corrupted ACK is received, do nothing!\n", NAME(AorB));
+    return;
   }
+  if (packet->acknum != NOTINUSE)
+    AckInput(AorB, packet->acknum, packet->seqnum != NOTINUSE);
+  if (packet->seqnum != NOTINUSE)
+    DataInput(AorB, packet);
+}
 
-  /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+void A_input(const struct pkt *packet)
+{
+  Input(A, packet);
+}
 
-  /* we don't have any data to send.  fill payload with 0's */
-  for ( i=0; i<20 ; i++ )
-    sendpkt.payload[i] = '0';
+void B_input(const struct pkt *packet)
+{
+  Input(B, packet);
+}
 
-  /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt);
+/* called when the emulator's timer of AorB goes off */
+static void TimerInterrupt(int AorB)
+{
+  struct gbn *gbn = protocol_state();
+  struct endpoint *ep = &gbn->ep[AorB];
+  double now = get_sim_time();
 
-  /* send out packet */
-  tolayer3 (B, sendpkt);
+  ep->timerrunning = false;
+
+  if (ep->windowcount > 0 && ep->timeout <= now + TIMER_SLACK) {
+    if (TRACE > 0)
+      printf("----%c: time out,resend packets!\n", NAME(AorB));
+
+    /* the timeout was too short or a packet was lost, wait longer next time */
+    rto_backoff(&ep->rto);
+    if (gbn->cc)
+      cc_timeout(&ep->cc, ep->nsent);
+
+    ResendWindow(AorB);
+  }
+
+  /* the held back ACK has waited long enough, unless it went along with the resent data */
+  if (ep->pendingacks > 0 && ep->acktime <= now + TIMER_SLACK) {
+    if (TRACE > 0)
+      printf("----%c: ACK delay is over, send ACK!\n", NAME(AorB));
+    SendAck(AorB);
+  }
+
+  SetTimer(AorB);
+}
+
+void A_timerinterrupt(void)
+{
+  TimerInterrupt(A);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
 void B_init(void)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  struct gbn *gbn = protocol_state();
+
+  gbn->ep[A].expectedseqnum = 0;
+  gbn->ep[B].expectedseqnum = 0;
 }
 
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
 
-/* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+/* with simplex transfer from A to B the emulator never calls B_output() */
+void B_output(const struct msg *message)
 {
+  Output(B, message);
 }
 
 /* called when B's timer goes off */
 void B_timerinterrupt(void)
 {
+  TimerInterrupt(B);
 }
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Without loss or corruption a protocol must deliver without resending:
+# a timeout that fires before the ACK can come back resends the window
+# over and over.  Run after build.sh; the exit status is 1 if a scenario
+# resends more than 2% of the messages it delivered.  The runs are
+# limited to 2 GB, so a runaway fails instead of taking the machine down.
+cd "$(dirname "$0")"
+ulimit -v 2000000
+failed=0
+
+scenarios=(
+  "sr  messages=2000 lambda=1 window=16 seqspace=32"
+  "sr  messages=5000 lambda=1 window=500 seqspace=1000 queue=1000"
+  "gbn messages=5000 lambda=1 window=500 seqspace=1000 queue=1000"
+  "gbn messages=2000 lambda=10"
+  "sr  messages=2000 lambda=10"
+)
+
+for s in "${scenarios[@]}"; do
+  p=${s%% *}
+  args="loss=0 corrupt=0 direction=0 seed=9999 ${s#* }"
+  r=$(./$p $args trace=0 stats=csv </dev/null | awk -F, '
+    /^messages,/ { for (i = 1; i <= NF; i++) col[$i] = i; next }
+    NF > 40 { print $col["messages_delivered"], $col["packets_resent"] }')
+  set -- $r
+  if [ -z "$r" ] || [ "$1" -eq 0 ] || [ $(($2 * 50)) -gt "$1" ]; then
+    echo "FAIL $s: delivered ${1:-?} resent ${2:-?}"
+    failed=1
+  else
+    echo "ok   $s: delivered $1 resent $2"
+  fi
+done
+exit $failed
@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200112L   /* clock_gettime(), pthread_cond_timedwait() */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "sim.h"
+
+#define STDOUT_BUFSIZE (1 << 16)   /* trace output is written in blocks of this size */
+
+/* snapshotms=X: a thread reads the run's counters with sim_snapshot()
+   every X ms of wall-clock time and prints them, the run never waits
+   for it.  The condition variable only wakes it up at the end. */
+struct snapshotter {
+  struct sim *s;
+  double ms;
+  int running;                  /* under lock */
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  struct sim_snapshot last;     /* printed last, or the first counters read */
+  int havelast;
+};
+
+static void addms(struct timespec *t, double ms)
+{
+  long ns = t->tv_nsec + (long)(ms * 1e6);
+
+  t->tv_sec += ns / 1000000000L;
+  t->tv_nsec = ns % 1000000000L;
+}
+
+/* print the counters if the run got on since the last line */
+static void printsnapshot(struct snapshotter *sn)
+{
+  struct sim_snapshot now;
+
+  if (!sim_snapshot(sn->s, &now))
+    return;
+  if (!sn->havelast) {          /* the counters the first rates are taken from */
+    sn->last = now;
+    sn->havelast = 1;
+    return;
+  }
+  if (now.events == sn->last.events)
+    return;
+  sim_snapshot_rates(&now, &sn->last);
+  now.number = sn->last.number + 1;
+  sim_print_snapshot(sn->s, &now);
+  sn->last = now;
+}
+
+static void *snapshotthread(void *arg)
+{
+  struct snapshotter *sn = arg;
+  struct timespec next;
+
+  clock_gettime(CLOCK_REALTIME, &next);
+  pthread_mutex_lock(&sn->lock);
+  while (sn->running) {
+    addms(&next, sn->havelast ? sn->ms : 1.0);   /* poll until the run has started */
+    while (sn->running && pthread_cond_timedwait(&sn->done, &sn->lock, &next) == 0)
+      ;
+    if (sn->running)
+      printsnapshot(sn);
+  }
+  pthread_mutex_unlock(&sn->lock);
+  return NULL;
+}
+
+/* sim_run() with a snapshotms= thread, if one is asked for */
+static void run(struct sim *s)
+{
+  struct snapshotter sn;
+  const char *ms = sim_get(s, "snapshotms");
+  pthread_t thread;
+
+  memset(&sn, 0, sizeof(sn));
+  sn.s = s;
+  sn.ms = ms != NULL ? strtod(ms, NULL) : 0.0;
+  sn.running = 1;
+  pthread_mutex_init(&sn.lock, NULL);
+  pthread_cond_init(&sn.done, NULL);
+  if (sn.ms <= 0 || pthread_create(&thread, NULL, snapshotthread, &sn) != 0) {
+    sim_run(s);
+    return;
+  }
+  sim_run(s);
+  pthread_mutex_lock(&sn.lock);
+  sn.running = 0;
+  pthread_cond_signal(&sn.done);
+  pthread_mutex_unlock(&sn.lock);
+  pthread_join(thread, NULL);
+  printsnapshot(&sn);           /* and one of the end */
+  pthread_mutex_destroy(&sn.lock);
+  pthread_cond_destroy(&sn.done);
+}
+
+/* run a single simulation, parameters that are not given on the */
+/* command line are prompted for                                 */
+int main(int argc, char **argv)
+{
+  struct sim *s;
+  int i;
+
+  setvbuf(stdout, NULL, _IOFBF, STDOUT_BUFSIZE);
+  s = sim_new();
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      printf("usage: %s [key=value ...]\n", argv[0]);
+      sim_usage();
+      printf("parameters that are not given are prompted for\n");
+      return EXIT_SUCCESS;
+    }
+    if (!sim_set(s, argv[i])) {
+      printf("unrecognised argument %s\n", argv[i]);
+      printf("usage: %s [key=value ...]\n", argv[0]);
+      sim_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  sim_configure(s, 1);
+  run(s);
+  sim_checkoptions(s);   /* after the run, the protocol reads its own parameters */
+  sim_report(s);
+  sim_free(s);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "msgqueue.h"
+
+void msgqueue_init(struct msgqueue *q, int capacity)
+{
+  int size = 1;
+
+  while (size < capacity)
+    size *= 2;
+  q->size = get_payload_size();
+  q->data = protocol_alloc(size * q->size);
+  q->queuedat = protocol_alloc(size * sizeof(double));
+  protocol_pointer(&q->data);        /* the queue is part of the protocol state */
+  protocol_pointer(&q->queuedat);
+  q->mask = size - 1;
+  q->capacity = capacity;
+  q->first = 0;
+  q->count = 0;
+}
+
+bool msgqueue_put(struct msgqueue *q, const struct msg *message)
+{
+  struct protocol_stats *stats = protocol_stats();
+  int i;
+
+  if (q->count == q->capacity)
+    return false;
+  i = (q->first + q->count) & q->mask;
+  memcpy(q->data + i * q->size, message->data, q->size);
+  q->queuedat[i] = get_sim_time();
+  q->count++;
+  stats->messages_queued++;
+  stats->queue_depth++;
+  if (q->count > stats->queue_peak)
+    stats->queue_peak = q->count;
+  return true;
+}
+
+bool msgqueue_get(struct msgqueue *q, struct msg *message)
+{
+  struct protocol_stats *stats = protocol_stats();
+  double delay;
+
+  if (q->count == 0)
+    return false;
+  memcpy(message->data, q->data + q->first * q->size, q->size);
+  delay = get_sim_time() - q->queuedat[q->first];
+  q->first = (q->first + 1) & q->mask;
+  q->count--;
+  stats->queue_depth--;
+  stats->queue_delay_sum += delay;
+  if (delay > stats->queue_delay_max)
+    stats->queue_delay_max = delay;
+  return true;
+}
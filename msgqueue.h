@@ -0,0 +1,24 @@
+/* Bounded FIFO of messages that arrived from layer 5 while the send
+   window was full.  The ring is allocated once with protocol_alloc(),
+   the queueing statistics go to protocol_stats().  Only the
+   get_payload_size() bytes of a message that are used are stored. */
+
+#include <stdbool.h>
+
+struct msgqueue {
+  char *data;              /* ring of a power of 2 messages, size bytes each */
+  size_t size;             /* bytes of data in a message */
+  double *queuedat;        /* when each message was queued */
+  int mask;                /* ring size - 1 */
+  int capacity;            /* at most this many messages wait, 0 = no queue */
+  int first;               /* index of the oldest message */
+  int count;               /* number of messages waiting */
+};
+
+extern void msgqueue_init(struct msgqueue *, int capacity);
+
+/* false if the queue is full and the message has to be dropped */
+extern bool msgqueue_put(struct msgqueue *, const struct msg *);
+
+/* take the oldest message, false if there is none */
+extern bool msgqueue_get(struct msgqueue *, struct msg *);
@@ -0,0 +1,67 @@
+#include "rto.h"
+
+/* ******************************************************************
+   Adaptive retransmission timeout (RFC 6298).  With alpha = 1/8 and
+   beta = 1/4 the first sample R sets SRTT = R and RTTVAR = R/2, later
+   ones update
+     RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+     SRTT   = 7/8 SRTT + 1/8 R
+   and the timeout is SRTT + max(G, 4 RTTVAR), kept within [RTO_MIN,
+   RTO_MAX].  Without G a link with a fixed delay drives RTTVAR to 0
+   and the timer to the exact round trip.
+   A timeout doubles it until the next sample (RFC 6298 5.5-5.7): an
+   ACK of a resent packet says nothing about the round trip, and
+   dropping the backoff on it keeps a timer that is too short for the
+   queue, which then resends everything in flight again.
+   If the receiver may hold ACKs back, the hold is added to the first
+   timeout and to RTO_MIN (like max_ack_delay in QUIC): otherwise a
+   timer shorter than the hold fires before every ACK, and as all the
+   packets are then resent Karn's rule never gives a sample to fix it.
+**********************************************************************/
+
+static double clamp(struct rto *r, double rto)
+{
+  if (rto < RTO_MIN + r->ackdelay)
+    return RTO_MIN + r->ackdelay;
+  if (rto > RTO_MAX)
+    return RTO_MAX;
+  return rto;
+}
+
+void rto_init(struct rto *r, double initial)
+{
+  r->srtt = 0.0;
+  r->rttvar = 0.0;
+  r->ackdelay = 0.0;
+  r->base = r->rto = clamp(r, initial);
+  r->nsamples = 0;
+}
+
+void rto_ackdelay(struct rto *r, double ackdelay)
+{
+  r->ackdelay = ackdelay;
+  if (r->nsamples == 0)
+    r->base = r->rto = clamp(r, r->base + ackdelay);
+}
+
+void rto_sample(struct rto *r, double sample)
+{
+  double err;
+
+  if (r->nsamples == 0) {
+    r->srtt = sample;
+    r->rttvar = sample / 2;
+  }
+  else {
+    err = r->srtt - sample;
+    r->rttvar = 0.75 * r->rttvar + 0.25 * (err < 0 ? -err : err);
+    r->srtt = 0.875 * r->srtt + 0.125 * sample;
+  }
+  r->nsamples++;
+  r->base = r->rto = clamp(r, r->srtt + (4 * r->rttvar > RTO_G ? 4 * r->rttvar : RTO_G));   /* a new sample also ends any backoff */
+}
+
+void rto_backoff(struct rto *r)
+{
+  r->rto = clamp(r, 2 * r->rto);
+}
@@ -0,0 +1,31 @@
+/* Retransmission timeout estimation shared by the protocols:
+   Jacobson/Karels smoothed RTT and RTT variance, with exponential
+   backoff on timeouts.  Karn's rule is up to the caller: only pass
+   samples from packets that were sent exactly once. */
+
+#define RTO_MIN   2.0      /* a round trip can never be shorter than this */
+#define RTO_MAX   1.0e6    /* the backoff stops doubling here: far above any round
+                              trip a full window can queue up, RFC 6298 only
+                              asks for a maximum of at least 60 s */
+#define RTO_G     1.0      /* clock granularity G, the least variance allowance */
+
+struct rto {
+  double srtt;             /* smoothed round trip time */
+  double rttvar;           /* smoothed mean deviation of the round trip time */
+  double base;             /* timeout from the estimate alone */
+  double rto;              /* current timeout, including any backoff */
+  double ackdelay;         /* longest time the receiver holds an ACK back */
+  int nsamples;            /* 0 until the first measurement */
+};
+
+/* start with a timeout of initial until there is a measurement */
+extern void rto_init(struct rto *, double initial);
+
+/* the receiver may hold ACKs back for up to ackdelay time units */
+extern void rto_ackdelay(struct rto *, double ackdelay);
+
+/* a packet sent once was ACKed sample time units after it was sent */
+extern void rto_sample(struct rto *, double sample);
+
+/* the timer went off, double the timeout until the next sample */
+extern void rto_backoff(struct rto *);
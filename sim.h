@@ -0,0 +1,99 @@
+/* Interface used by the programs that drive the network emulator.
+   Each simulation is a self contained struct sim, so a program can run
+   several of them, one per thread at a time. */
+
+struct sim;
+
+/* parameters and final counters of a simulation */
+struct sim_results {
+  int messages;
+  double loss;
+  double corrupt;
+  int direction;
+  double lambda;
+  unsigned long seed;
+  double end_time;
+  int msgs_sent;             /* messages generated by layer 5 */
+  int window_full;
+  int total_acks;
+  int new_acks;
+  int packets_resent;
+  int packets_received;
+  int messages_delivered;
+  int tolayer3;              /* packets handed to layer 3 */
+  int lost;
+  int corrupted;
+  int peak_events;
+  double latency_mean;       /* A_output() to tolayer5() of delivered messages */
+  double latency_p50;
+  double latency_p90;
+  double latency_p99;
+  double latency_max;
+  double goodput;            /* messages delivered per time unit */
+  double util_ab;            /* fraction of the time a packet was on its way to B */
+  double util_ba;
+  int messages_queued;       /* messages that waited for room in the window */
+  int queue_peak;
+  double queue_delay_mean;
+  double queue_delay_max;
+  double queue_depth_mean;   /* time average of the queue length */
+  int fast_retransmits;
+  int acks_sent;
+  int acks_piggybacked;
+  int bidirectional;
+  int payload;               /* bytes of data in a message or packet */
+  int link_drops;            /* dropped by the link queues (link model) */
+  int red_drops;             /* of which RED dropped early */
+  int loss_bursts;           /* runs of packets lost in a row */
+  int reordered;             /* packets held up by reorder= */
+  int flows;                 /* pairs of A and B sharing the channels */
+  double fairness;           /* Jain's index of the messages each flow delivered */
+  long events;               /* events dispatched */
+  int allocations;           /* memory allocations by the emulator and protocol_alloc() */
+};
+
+extern struct sim *sim_new(void);
+extern void sim_free(struct sim *);
+
+/* add a key=value parameter (config=FILE reads a file of them).
+   Returns 0 if the argument is not of that form. */
+extern int sim_set(struct sim *, const char *);
+extern const char *sim_get(struct sim *, const char *key);   /* NULL if not given */
+
+/* read the parameters; missing ones are prompted for if interactive,
+   otherwise messages and lambda are required and the rest default to 0 */
+extern void sim_configure(struct sim *, int interactive);
+extern void sim_checkoptions(struct sim *);   /* warn about unused parameters */
+extern void sim_usage(void);                  /* print the known parameters */
+
+/* a live snapshot of a run (snapshot=T or snapshotms=X), the rates are
+   those since the snapshot before */
+struct sim_snapshot {
+  long number;               /* 1 for the first snapshot */
+  double time;               /* simulation clock */
+  double wall;               /* seconds since sim_run() started */
+  long events;               /* events dispatched */
+  double events_per_sec;
+  int delivered;             /* messages delivered */
+  double throughput;         /* messages delivered per time unit */
+  int inflight;              /* packets on their way in the channels */
+  int sent;                  /* packets handed to layer 3 */
+  int resent;                /* packets resent by the protocol */
+  double resent_rate;        /* fraction of the packets sent that were resends */
+  int queued;                /* messages waiting for room in a window */
+  int window_full;           /* messages refused so far */
+};
+
+extern void sim_run(struct sim *);
+
+/* copy the counters the run published last, at most 1024 events ago;
+   returns 0 if there are none yet.  It may be called from another thread
+   while sim_run() is running: they are published with a sequence lock, so
+   the reader never slows the run down.  wall is the time of the call,
+   number and the rates are 0, a reader fills them in with
+   sim_snapshot_rates() */
+extern int sim_snapshot(struct sim *, struct sim_snapshot *);
+extern void sim_snapshot_rates(struct sim_snapshot *now, const struct sim_snapshot *before);
+extern void sim_print_snapshot(struct sim *, const struct sim_snapshot *);   /* as a JSON line */
+extern void sim_results(struct sim *, struct sim_results *);
+extern void sim_report(struct sim *);         /* human readable summary and stats= dump */
@@ -1,8 +1,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "emulator.h"
 #include "sr.h"
+#include "rto.h"
+#include "msgqueue.h"
+#include "checksum.h"
+#include "cc.h"
 
 /* ******************************************************************
    SR protocol.  Adapted from J.F.Kurose
@@ -20,253 +25,719 @@
    - removed bidirectional SR code and other code not used by prac.
    - fixed C style to adhere to current programming style
    - added SR implementation
+   - every packet in the window has its own logical retransmission timer,
+   the emulator's single timer is always set for the earliest of them.
+   All timers run for the same timeout, so the unACKed packets are kept
+   in the order of their last send and the first of them expires first:
+   finding the next expiry and the expired packets does not walk the window
+   - the timeout adapts to the measured round trip time (rto.c), RTT is
+   only the timeout used before the first measurement
+   - window=N and seqspace=N set the window and sequence space at run
+   time, the buffers are sized to match
+   - with queue=N up to N messages that find the window full wait in a
+   FIFO and are sent as ACKs make room, instead of being dropped
+   - with sack=1 every ACK also carries B's next expected sequence number
+   and a bitmap of the packets B holds beyond it, so one ACK that gets
+   through makes up for the ones that were lost
+   - ackdelay=T makes B hold the ACK of an in-order packet for up to T
+   time units, so that one ACK covers ackevery=N packets.  The held back
+   ACKs are only known to A through the SACK, so ackdelay implies sack=1
+   - bidirectional=1 makes B send messages too.  A and B then both run a
+   sender and a receiver, and every data packet carries a cumulative ACK
+   for the other direction: its receiver has everything up to acknum.  A
+   separate ACK is only sent if no data has taken it along within ackdelay
+   (ACKDELAY by default)
+   - checksum=inet or crc32c replaces the byte sum (checksum.c)
+   - messages and packets are passed by pointer and their payload is
+   copied once, into the window buffer or the receive buffer, with only
+   get_payload_size() bytes being used.  The SACK uses the whole payload
+   - cc=1 adds congestion control (cc.c): new packets only enter the
+   window while it holds fewer than cwnd.  Without duplicate ACKs there is
+   no fast recovery, only the timeouts shrink the congestion window.  The
+   window grows the queue at the bottleneck and so the round trip, which
+   the per-packet timers take for a loss.  An ACK for a resent packet that
+   arrives sooner than half a round trip after the resend must be for the
+   first copy, and then the timeout is undone
 **********************************************************************/
 
-#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet
+#define RTT  16.0       /* initial timeout.  MUST BE SET TO 16.0 when submitting assignment */
+#define WINDOWSIZE 6    /* default maximum number of buffered unacked packet
                           MUST BE SET TO 6 when submitting assignment */
-#define SEQSPACE 12      /* the min sequence space for SR must be at least windowsize * 2 */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define TIMER_SLACK 0.001  /* a logical timer this close to expiry counts as expired */
+#define ACKEVERY 2      /* default number of packets a delayed ACK covers at most */
+#define ACKDELAY 5.0    /* default time an ACK waits for reverse data with bidirectional=1 */
+
+/* SACK layout of an ACK payload: the receiver's next expected sequence
+   number in 4 bytes, least significant first, then one bit for each of
+   the sequence numbers following it, as many as the payload has room for */
+#define SACK_BASEBYTES 4
+
+/* one end of the connection.  Both run the same code, but unless the
+   run is bidirectional A only sends data and B only sends ACKs */
+struct endpoint {
+  /* sender variables */
+  char *buffer;                   /* slots for storing packets waiting for ACK, see Slot() */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int nextseqnum;                 /* the next sequence number to be used by the sender */
+  bool *acked;                    /* remembers which sequence numbers have been ACKed */
+  double *sendtime;             /* record last (re)send time for each slot */
+  bool *resent;                 /* sent more than once, so no RTT sample (Karn's rule) */
+  int *sendnext, *sendprev;     /* the unACKed slots in the order of their last send */
+  int sendfirst, sendlast;      /* the earliest and latest sent of them, -1 if none */
+  int nunacked;                 /* the number of unACKed slots */
+  struct msgqueue queue;         /* messages waiting for room in the window */
+  struct rto rto;               /* retransmission timeout estimator */
+  struct cc cc;                 /* congestion window, if sr->cc */
+
+  /* receiver variables */
+  int expectedseqnum;           /* the sequence number expected next by the receiver */
+  char *recvdata;               /* Receiver-side buffer: payloadsize bytes for each sequence number */
+  bool *received;               /* Marks whether a packet for each sequence number has already been cached */
+  int pendingacks;              /* in-order packets received whose ACK is held back */
+  int lastseqnum;               /* the latest of them, echoed when the ACK goes out */
+  double acktime;               /* when the held back ACK has to go out */
+
+  /* the emulator's timer serves the packets' timers and the held back ACK */
+  bool timerrunning;            /* is the emulator's timer started? */
+  double timerexpiry;           /* and when it goes off */
+};
+
+/* all protocol variables, one copy per simulation (see protocol_state()) */
+struct sr {
+  /* parameters */
+  int windowsize;                 /* the maximum number of buffered unacked packets */
+  int windowmask;                 /* buffer size - 1, the buffer size is a power of 2 */
+  int seqspace;                   /* number of sequence numbers */
+  int seqmask;                    /* seqspace - 1 if that is a power of 2, else 0 */
+  bool sack;                      /* ACKs carry a selective acknowledgement bitmap */
+  int checksum;                   /* enum checksum_kind */
+  bool bidirectional;             /* B sends data to A as well */
+  double ackdelay;                /* longest time an ACK is held back, 0 = ACK every packet at once */
+  int ackevery;                   /* a held back ACK is sent once it covers this many packets */
+  int payloadsize;                /* bytes of data in a message or packet */
+  size_t pktbytes;                /* bytes of a packet stored in a buffer */
+  int sackbits;                   /* sequence numbers a SACK has room for */
+  bool cc;                        /* congestion control limits the window */
+
+  struct pkt *ackpkt;             /* separate ACKs are built here */
+  struct endpoint ep[2];          /* A and B */
+};
+
+const size_t protocol_state_size = sizeof(struct sr);
+
+#define NAME(AorB) ((AorB) == A ? 'A' : 'B')
+
+/* the packet in slot i of the window buffer, the slots are PKT_SLOTBYTES() apart */
+static struct pkt *Slot(const struct sr *sr, const struct endpoint *ep, int i)
+{
+  return (struct pkt *)(ep->buffer + (size_t)i * sr->pktbytes);
+}
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
+   the packet is corrupted.  checksum=KIND chooses the algorithm, see checksum.c
 */
-int ComputeChecksum(struct pkt packet)
+int ComputeChecksum(const struct pkt *packet)
 {
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ )
-    checksum += (int)(packet.payload[i]);
+  const struct sr *sr = protocol_state();
 
-  return checksum;
+  return checksum_packet(sr->checksum, packet, sr->payloadsize);
 }
 
-bool IsCorrupted(struct pkt packet)
+bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
 }
 
 
-/********* Sender (A) variables and functions ************/
+/* sequence number n places after seq, n >= 0 */
+static int SeqAdd(const struct sr *sr, int seq, int n)
+{
+  if (sr->seqmask)
+    return (seq + n) & sr->seqmask;
+  return (seq + n) % sr->seqspace;
+}
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-static bool acked[SEQSPACE];            /* remembers which sequence numbers have been ACKed */
-static float sendtime[WINDOWSIZE];   /* record last (re)send time for each slot */
+/* is seqnum one of the count sequence numbers starting at first? */
+static bool InWindow(const struct sr *sr, int first, int count, int seqnum)
+{
+  return seqnum >= 0 && seqnum < sr->seqspace &&
+         SeqAdd(sr, seqnum + sr->seqspace - first, 0) < count;
+}
 
+/* put window slot slot of ep last in the send order */
+static void SendOrderAppend(struct endpoint *ep, int slot)
+{
+  ep->sendnext[slot] = -1;
+  ep->sendprev[slot] = ep->sendlast;
+  if (ep->sendlast >= 0)
+    ep->sendnext[ep->sendlast] = slot;
+  else
+    ep->sendfirst = slot;
+  ep->sendlast = slot;
+  ep->nunacked++;
+}
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+/* take window slot slot of ep out of the send order */
+static void SendOrderRemove(struct endpoint *ep, int slot)
 {
-  struct pkt sendpkt;
-  int i;
+  if (ep->sendprev[slot] >= 0)
+    ep->sendnext[ep->sendprev[slot]] = ep->sendnext[slot];
+  else
+    ep->sendfirst = ep->sendnext[slot];
+  if (ep->sendnext[slot] >= 0)
+    ep->sendprev[ep->sendnext[slot]] = ep->sendprev[slot];
+  else
+    ep->sendlast = ep->sendprev[slot];
+  ep->nunacked--;
+}
 
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+/* set the emulator's timer of AorB for the earliest logical timer of the
+   unACKed packets and the held back ACK, or stop it if there is none */
+static void SetTimer(int AorB)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  double now = get_sim_time();
+  double expiry = 0.0;
+  bool pending = false;
+
+  /* the packet sent the longest ago has the earliest timer */
+  if (ep->sendfirst >= 0) {
+    expiry = ep->sendtime[ep->sendfirst] + ep->rto.rto;
+    pending = true;
+  }
+  if (ep->pendingacks > 0 && (!pending || ep->acktime < expiry)) {
+    expiry = ep->acktime;
+    pending = true;
+  }
+  if (ep->timerrunning && (!pending || expiry != ep->timerexpiry)) {
+    stoptimer(AorB);
+    ep->timerrunning = false;
+  }
+  if (pending && !ep->timerrunning) {
+    starttimer(AorB, expiry > now ? expiry - now : 0.0);
+    ep->timerrunning = true;
+    ep->timerexpiry = expiry;
+  }
+}
+
+/* send a data packet, with a cumulative ACK for the reverse direction if there is one */
+static void SendData(int AorB, struct pkt *packet)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+
+  if (sr->bidirectional) {
+    packet->acknum = SeqAdd(sr, ep->expectedseqnum, sr->seqspace - 1);
+    if (ep->pendingacks > 0) {
+      protocol_stats()->acks_piggybacked++;
+      ep->pendingacks = 0;
+    }
+  }
+  packet->checksum = ComputeChecksum(packet);
+  tolayer3(AorB, packet);
+}
+
+/********* Sender variables and functions ************/
+
+/* the number of packets the window of AorB may hold */
+static int SendWindow(const struct sr *sr, int AorB)
+{
+  if (sr->cc)
+    return cc_window(&sr->ep[AorB].cc);
+  return sr->windowsize;
+}
+
+/* put a message in the window and send it, the window must have room */
+static void SendMessage(int AorB, const struct msg *message)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  struct pkt *sendpkt;
+
+  /* create packet in its place in the window buffer */
+  /* windowlast will always be 0 for alternating bit; but not for GoBackN */
+  ep->windowlast = (ep->windowlast + 1) & sr->windowmask;
+  sendpkt = Slot(sr, ep, ep->windowlast);
+  sendpkt->seqnum = ep->nextseqnum;
+  sendpkt->acknum = NOTINUSE;
+  memcpy(sendpkt->payload, message->data, sr->payloadsize);
+  ep->sendtime[ep->windowlast] = get_sim_time();
+  ep->resent[ep->windowlast] = false;
+  ep->acked[sendpkt->seqnum] = false;
+  SendOrderAppend(ep, ep->windowlast);
+  ep->windowcount++;
+
+  /* send out packet */
+  if (TRACE > 0)
+    printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+  SendData(AorB, sendpkt);
+
+  /* start the packet's own timer, the first packet in the window starts the real one */
+  SetTimer(AorB);
+
+  /* get next sequence number, wrap back to 0 */
+  ep->nextseqnum = SeqAdd(sr, ep->nextseqnum, 1);
+}
+
+/* send queued messages while the window has room */
+static void DrainQueue(int AorB)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  struct msg message;
+
+  while (ep->windowcount < SendWindow(sr, AorB) && msgqueue_get(&ep->queue, &message)) {
     if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for ( i=0; i<20 ; i++ )
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+      printf("----%c: window has room, send queued message to layer3!\n", NAME(AorB));
+    SendMessage(AorB, &message);
+  }
+}
 
-    /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+static void Output(int AorB, const struct msg *message)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
 
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+  /* if not blocked waiting on ACK, and no older message is waiting */
+  if ( ep->windowcount < SendWindow(sr, AorB) && ep->queue.count == 0) {
+    if (TRACE > 1)
+      printf("----%c: New message arrives, send window is not full, send new messge to layer3!\n", NAME(AorB));
+    SendMessage(AorB, message);
   }
-  /* if blocked,  window is full */
+  /* if blocked, the message waits in the queue if there is room */
+  else if (msgqueue_put(&ep->queue, message)) {
+    if (TRACE > 0)
+      printf("----%c: New message arrives, send window is full, message queued\n", NAME(AorB));
+  }
+  /* window and queue are full */
   else {
     if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
+      printf("----%c: New message arrives, send window is full\n", NAME(AorB));
+    protocol_stats()->window_full++;
   }
 }
 
+void A_output(const struct msg *message)
+{
+  Output(A, message);
+}
+
 
-/* called from layer 3, when a packet arrives for layer 4
-   In this practical this will always be an ACK as B never sends data.
-*/
-void A_input(struct pkt packet)
+/* mark the packet in window slot i of AorB as ACKed, false if it already was */
+static bool AckSlot(int AorB, int i)
 {
-  /*int ackcount = 0;*/
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  int slot = (ep->windowfirst + i) & sr->windowmask;
+
+  if (ep->acked[Slot(sr, ep, slot)->seqnum])
+    return false;
+  ep->acked[Slot(sr, ep, slot)->seqnum] = true;   /*mark this sequence number as ACKed so the sender can slide its window*/
+  SendOrderRemove(ep, slot);                   /* its timer is gone */
+  return true;
+}
 
-  /* if received ACK is not corrupted */
-  if (!IsCorrupted(packet)) 
-  {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-  
-    if(!acked[packet.acknum])
-    {
-      if (TRACE > 0 )
-        printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-      new_ACKs++;
-      acked[packet.acknum] = true; /*mark this sequence number as ACKed so the sender can slide its window*/ 
-    
-      /* If the ACK refers to the very first packet in the window, we may slide */
-      if (packet.acknum == buffer[windowfirst].seqnum)
-      {
-        /* Skip over every slot that has already been individually ACKed        */
-        while (windowcount > 0 && acked[buffer[windowfirst].seqnum])
-        {
-          windowfirst  = (windowfirst + 1) % WINDOWSIZE;   /*move window head*/ 
-          windowcount--;                                   /*shrink window*/ 
-        }
-
-    /* start timer again if there are still more unacked packets in window */
-        stoptimer(A);
-        if (windowcount > 0)
-          starttimer(A, RTT);
-      }
-    }
-        else
-          if (TRACE > 0)
-        printf ("----A: duplicate ACK received, do nothing!\n");
+/* mark what a SACK payload says the other side has, returns the number of packets newly ACKed */
+static int AckSack(int AorB, const struct pkt *packet)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  const unsigned char *sack = (const unsigned char *)packet->payload;
+  long base = 0;
+  int i, d, bit, count = 0;
+
+  for (i = SACK_BASEBYTES - 1; i >= 0; i--)
+    base = (base << 8) | sack[i];
+  if (base >= sr->seqspace)
+    return 0;
+  /* d packets at the head of the window were delivered in order, a base
+     outside the window is from an ACK older than the window */
+  d = SeqAdd(sr, (int)base + sr->seqspace - Slot(sr, ep, ep->windowfirst)->seqnum, 0);
+  if (d > ep->windowcount)
+    return 0;
+  for (i = 0; i < ep->windowcount; i++) {
+    bit = i - d - 1;
+    if (i < d || (bit >= 0 && bit < sr->sackbits &&
+                  (sack[SACK_BASEBYTES + bit / 8] & (1 << (bit % 8)))))
+      count += AckSlot(AorB, i);
   }
-  else
-    if (TRACE > 0)
-      printf ("----A: corrupted ACK is received, do nothing!\n");
+  return count;
 }
 
-/* called when A's timer goes off */
-void A_timerinterrupt(void)
+/* an uncorrupted ACK arrived at AorB.  A separate ACK is for the one packet
+   it echoes (and what its SACK says), one that came along with data is
+   cumulative */
+static void AckInput(int AorB, const struct pkt *packet)
 {
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  bool piggybacked = packet->seqnum != NOTINUSE;
+  int i, slot, nsacked = 0;
+  bool acked = false;
 
   if (TRACE > 0)
-    printf("----A: time out,resend packets!\n");
+    printf("----%c: uncorrupted ACK %d is received\n", NAME(AorB), packet->acknum);
+  protocol_stats()->total_ACKs_received++;
 
-  /* Retransmit the left-most un-ACKed packet in the send window (buffer[windowfirst]) */
-  if (TRACE > 0)
-    printf("---A: resending packet %d\n", buffer[windowfirst].seqnum);
+  /* only an ACK for a packet in the window can be new, anything else is
+     a late copy for a packet whose slot has already been reused */
+  if (ep->windowcount > 0 &&
+      InWindow(sr, Slot(sr, ep, ep->windowfirst)->seqnum, ep->windowcount, packet->acknum))
+  {
+    slot = SeqAdd(sr, packet->acknum + sr->seqspace - Slot(sr, ep, ep->windowfirst)->seqnum, 0);
+    if (piggybacked)
+      for (i = 0; i < slot; i++)
+        nsacked += AckSlot(AorB, i);
+    if ((acked = AckSlot(AorB, slot))) {
+      /* measure the round trip, unless the packet was sent more than once.
+         Any backoff stays until then, SR keeps sending packets that can be
+         measured and dropping it early made loaded runs resend everything */
+      slot = (ep->windowfirst + slot) & sr->windowmask;
+      if (!ep->resent[slot])
+        rto_sample(&ep->rto, get_sim_time() - ep->sendtime[slot]);
+      else if (sr->cc && get_sim_time() - ep->sendtime[slot] < ep->rto.srtt / 2)
+        cc_undo(&ep->cc);
+    }
+  }
+  if (sr->sack && !piggybacked && ep->windowcount > 0)
+    nsacked += AckSack(AorB, packet);
+
+  if (acked || nsacked > 0)
+  {
+    if (TRACE > 0 )
+      printf("----%c: ACK %d is not a duplicate\n", NAME(AorB), packet->acknum);
+    if (TRACE > 0 && nsacked > 0)
+      printf("----%c: %s acknowledges %d more packets\n", NAME(AorB), piggybacked ? "ACK" : "SACK", nsacked);
+    protocol_stats()->new_ACKs++;
+
+    /* Skip over every slot at the head of the window that has been individually ACKed */
+    while (ep->windowcount > 0 && ep->acked[Slot(sr, ep, ep->windowfirst)->seqnum])
+    {
+      ep->windowfirst  = (ep->windowfirst + 1) & sr->windowmask;   /*move window head*/ 
+      ep->windowcount--;                                   /*shrink window*/ 
+    }
 
+    /* the ACKed packet's timer is gone, the real timer may have to move */
+    SetTimer(AorB);
 
-  tolayer3(A, buffer[windowfirst]);
-  packets_resent++;
+    /* the congestion window grows by what got through */
+    if (sr->cc)
+      cc_ack(&ep->cc, acked + nsacked);
+
+    /* the window may have room again for queued messages */
+    DrainQueue(AorB);
+  }
+  else
+    if (TRACE > 0)
+      printf ("----%c: duplicate ACK received, do nothing!\n", NAME(AorB));
+}
+
+/* Retransmit every un-ACKed packet of AorB whose own timer has expired.
+   They are at the head of the send order, and each resend moves its
+   packet to the tail */
+static void ResendExpired(int AorB)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  double now = get_sim_time();
+  bool resent = false;
+  int slot, last = ep->sendlast, flight = ep->nunacked;
+
+  while ((slot = ep->sendfirst) >= 0 && ep->sendtime[slot] + ep->rto.rto <= now + TIMER_SLACK) {
+    if (!resent && TRACE > 0)
+      printf("----%c: time out,resend packets!\n", NAME(AorB));
+    if (TRACE > 0)
+      printf("---%c: resending packet %d\n", NAME(AorB), Slot(sr, ep, slot)->seqnum);
+    SendData(AorB, Slot(sr, ep, slot));
+    protocol_stats()->packets_resent++;
+    ep->sendtime[slot] = now;
+    ep->resent[slot] = true;
+    resent = true;
+    SendOrderRemove(ep, slot);
+    SendOrderAppend(ep, slot);
+    if (slot == last)               /* the ones behind it were just resent */
+      break;
+  }
 
-  if (windowcount > 0)
-    starttimer(A, RTT);   /* restart timer for the oldest outstanding packet */  
+  /* the timeout was too short or a packet was lost, wait longer next time.
+     Every packet that expired has been resent, the smaller congestion
+     window holds back the new ones */
+  if (resent) {
+    rto_backoff(&ep->rto);
+    if (sr->cc)
+      cc_timeout(&ep->cc, flight);
+  }
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
 void A_init(void)
 {
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.
-		     new packets are placed in winlast + 1
-		     so initially this is set to -1
-		   */
-  windowcount = 0;
-  /* initialise per-packet bookkeeping for Selective Repeat */
-  int i; 
-  for (i = 0; i < SEQSPACE; ++i) {
-    acked[i]    = false;
-    sendtime[i] = 0.0f;
+  struct sr *sr = protocol_state();
+  struct endpoint *ep;
+  int bufsize = 1;
+  int queue;
+  int i;
+
+  /* parameters, B_init() relies on A_init() being called first */
+  sr->windowsize = protocol_option("window", WINDOWSIZE);
+  if (sr->windowsize < 1)
+    protocol_badoption("window", "the window must hold at least one packet");
+  sr->seqspace = protocol_option("seqspace", 2 * sr->windowsize);   /* the SR minimum */
+  if (sr->seqspace < 2 * sr->windowsize)
+    protocol_badoption("seqspace", "SR needs at least 2 * window sequence numbers");
+  sr->seqmask = (sr->seqspace & (sr->seqspace - 1)) == 0 ? sr->seqspace - 1 : 0;
+
+  /* messages that find the window full wait here, by default they are dropped */
+  queue = protocol_option("queue", 0);
+  if (queue < 0)
+    protocol_badoption("queue", "the queue cannot hold fewer than 0 messages");
+
+  sr->checksum = checksum_kind(protocol_string_option("checksum", "sum"));
+  if (sr->checksum < 0)
+    protocol_badoption("checksum", "use sum, inet or crc32c");
+
+  sr->bidirectional = protocol_option("bidirectional", BIDIRECTIONAL) != 0;
+  sr->ackdelay = protocol_float_option("ackdelay", sr->bidirectional ? ACKDELAY : 0.0);
+  if (sr->ackdelay < 0)
+    protocol_badoption("ackdelay", "use 0 to ACK every packet at once");
+  sr->ackevery = protocol_option("ackevery", ACKEVERY);
+  if (sr->ackevery < 1)
+    protocol_badoption("ackevery", "an ACK covers at least one packet");
+  sr->sack = protocol_option("sack", 0) != 0 || sr->ackdelay > 0;
+  sr->cc = protocol_option("cc", 0) != 0;
+
+  /* a separate ACK has no data, its payload is 0's or the SACK */
+  sr->payloadsize = get_payload_size();
+  sr->sackbits = (sr->payloadsize - SACK_BASEBYTES) * 8;
+  if (sr->sack && sr->sackbits <= 0)
+    protocol_badoption("payload", "a SACK needs a payload of more than 4 bytes");
+  sr->pktbytes = PKT_SLOTBYTES(sr->payloadsize);
+  sr->ackpkt = protocol_alloc(sr->pktbytes);
+  protocol_pointer(&sr->ackpkt);
+  if (!sr->sack)
+    memset(sr->ackpkt->payload, '0', sr->payloadsize);
+
+  /* the send buffer is a ring of a power of 2 packets so indexes wrap with a mask */
+  while (bufsize < sr->windowsize)
+    bufsize *= 2;
+  sr->windowmask = bufsize - 1;
+
+  /* initialise both senders' window, buffer and sequence number, B's
+     is only used if the run is bidirectional.  The pointers to the
+     buffers are registered so restore= can move them */
+  for (i = A; i <= B; i++) {
+    ep = &sr->ep[i];
+    ep->buffer = protocol_alloc(bufsize * sr->pktbytes);
+    protocol_pointer(&ep->buffer);
+    ep->sendtime = protocol_alloc(bufsize * sizeof(double));
+    protocol_pointer(&ep->sendtime);
+    ep->resent = protocol_alloc(bufsize * sizeof(bool));
+    protocol_pointer(&ep->resent);
+    ep->sendnext = protocol_alloc(bufsize * sizeof(int));
+    protocol_pointer(&ep->sendnext);
+    ep->sendprev = protocol_alloc(bufsize * sizeof(int));
+    protocol_pointer(&ep->sendprev);
+    ep->sendfirst = ep->sendlast = -1;
+    ep->nunacked = 0;
+    ep->acked = protocol_alloc(sr->seqspace * sizeof(bool));
+    protocol_pointer(&ep->acked);
+    ep->recvdata = protocol_alloc((size_t)sr->seqspace * sr->payloadsize);
+    protocol_pointer(&ep->recvdata);
+    ep->received = protocol_alloc(sr->seqspace * sizeof(bool));
+    protocol_pointer(&ep->received);
+    msgqueue_init(&ep->queue, queue);
+
+    ep->nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+    ep->windowfirst = 0;
+    ep->windowlast = -1;   /* windowlast is where the last packet sent is stored.
+                       new packets are placed in winlast + 1
+                       so initially this is set to -1
+                     */
+    ep->windowcount = 0;
+    if (sr->cc && (i == A || sr->bidirectional))
+      cc_init(&ep->cc, i, sr->windowsize);
+    /* per-packet bookkeeping for Selective Repeat starts zeroed (protocol_alloc) */
+    ep->timerrunning = false;
+    rto_init(&ep->rto, RTT);
+    rto_ackdelay(&ep->rto, sr->ackdelay);
   }
+}
+
+/********* Receiver variables and procedures ************/
+
 
+/* describe the receive buffer of AorB in the payload of an ACK, see SACK_BASEBYTES */
+static void PutSack(int AorB, struct pkt *ack)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  unsigned char *sack = (unsigned char *)ack->payload;
+  int i, bits = sr->windowsize - 1 < sr->sackbits ? sr->windowsize - 1 : sr->sackbits;
+
+  /* the rest of the payload stays zero from protocol_alloc() */
+  memset(sack, 0, SACK_BASEBYTES + (bits + 7) / 8);
+  for (i = 0; i < SACK_BASEBYTES; i++)
+    sack[i] = (ep->expectedseqnum >> (8 * i)) & 0xff;
+  /* expectedseqnum itself is missing, the bits start after it */
+  for (i = 0; i < bits; i++)
+    if (ep->received[SeqAdd(sr, ep->expectedseqnum, i + 1)])
+      sack[SACK_BASEBYTES + i / 8] |= 1 << (i % 8);
 }
 
-/********* Receiver (B)  variables and procedures ************/
+/* send a separate ACK echoing seqnum, with the SACK it also covers any held back ACKs */
+static void SendAck(int AorB, int seqnum)
+{
+  struct sr *sr = protocol_state();
+  struct pkt *sendpkt = sr->ackpkt;   /* the 0's are filled in by A_init() */
+
+  sendpkt->seqnum = NOTINUSE;        /* we don't use seqnum for pure ACKs */
+  sendpkt->acknum = seqnum;          /* echo back the packet's seq as ACK */
+
+  /* we don't have any data to send, the payload is 0's or the SACK */
+  if (sr->sack)
+    PutSack(AorB, sendpkt);
 
-static int expectedseqnum;           /* the sequence number expected next by the receiver */
-static int B_nextseqnum;             /* the sequence number for the next packets sent by B */
-static struct pkt recvpkt[SEQSPACE]; /* Receiver-side buffer: one slot for each sequence number */
-static bool received[SEQSPACE];      /* Marks whether a packet for each sequence number has already been cached */
+  /* computer checksum */
+  sendpkt->checksum = ComputeChecksum(sendpkt);
 
+  /* send out packet */
+  tolayer3 (AorB, sendpkt);
+  protocol_stats()->acks_sent++;
 
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+  sr->ep[AorB].pendingacks = 0;
+}
+
+/* an uncorrupted data packet arrived at AorB */
+static void DataInput(int AorB, const struct pkt *packet)
 {
-  struct pkt sendpkt;
-  int i;
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
+  bool inorder;
 
-  /* if not corrupted and received packet is in order */
-  if (!IsCorrupted(packet)) 
+  if (TRACE > 0)
+    printf("----%c: packet %d is correctly received, send ACK!\n", NAME(AorB), packet->seqnum);
+  protocol_stats()->packets_received++;
+
+  inorder = packet->seqnum == ep->expectedseqnum;
+
+  /* a packet from before the receive window was delivered already and
+     only needs its ACK again, anything further ahead cannot be ours yet */
+  if (!InWindow(sr, ep->expectedseqnum, sr->windowsize, packet->seqnum)) {
+    if (!InWindow(sr, SeqAdd(sr, ep->expectedseqnum, sr->seqspace - sr->windowsize), sr->windowsize, packet->seqnum))
+      return;
+  }
+  /* deliver to receiving application */
+  /* Store the packet in the receiver’s buffer if we have not seen it before */
+  else if (!ep->received[packet->seqnum]) {
+    ep->received[packet->seqnum] = true;
+    memcpy(ep->recvdata + (size_t)packet->seqnum * sr->payloadsize, packet->payload, sr->payloadsize);
+  }
+
+  /* Deliver every contiguous in-order packet to the application layer */
+  while (ep->received[ep->expectedseqnum]) 
   {
+    tolayer5(AorB, ep->recvdata + (size_t)ep->expectedseqnum * sr->payloadsize);    /* hand up the data */
+    ep->received[ep->expectedseqnum] = false;                /* free the slot    */
+    ep->expectedseqnum = SeqAdd(sr, ep->expectedseqnum, 1);
+  }
+
+  /* send an ACK for the received packet, or hold it back to cover the next one
+     too or to go along with data.  Only a packet that arrived in order and did
+     not fill a gap can wait */
+  if (sr->ackdelay > 0 && inorder && ep->expectedseqnum == SeqAdd(sr, packet->seqnum, 1) &&
+      ++ep->pendingacks < sr->ackevery) {
     if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
-
-    /* deliver to receiving application */
-    /* Store the packet in the receiver’s buffer if we have not seen it before */
-    if (!received[packet.seqnum]) {
-      received[packet.seqnum] = true;
-      for (i = 0; i < 20; ++i)
-        recvpkt[packet.seqnum].payload[i] = packet.payload[i];
-    }
+      printf("----%c: ACK %d held back\n", NAME(AorB), packet->seqnum);
+    ep->lastseqnum = packet->seqnum;
+    if (ep->pendingacks == 1)
+      ep->acktime = get_sim_time() + sr->ackdelay;
+  }
+  else
+    SendAck(AorB, packet->seqnum);
+  SetTimer(AorB);
+}
 
-    /* Deliver every contiguous in-order packet to the application layer */
-    while (received[expectedseqnum]) 
-    {
-      tolayer5(B, recvpkt[expectedseqnum].payload);    /* hand up the data */
-      received[expectedseqnum] = false;                /* free the slot    */
-      expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
-    }
+/* called from layer 3, when a packet arrives for layer 4 at AorB.  Unless
+   the run is bidirectional this is an ACK at A and a data packet at B */
+static void Input(int AorB, const struct pkt *packet)
+{
+  if (IsCorrupted(packet)) {
+    if (TRACE > 0)
+      printf ("----%c: corrupted packet is received, do nothing!\n", NAME(AorB));
+    return;
+  }
+  if (packet->acknum != NOTINUSE)
+    AckInput(AorB, packet);
+  if (packet->seqnum != NOTINUSE)
+    DataInput(AorB, packet);
+}
 
-    /* send an ACK for the received packet */
-    sendpkt.seqnum = NOTINUSE;        /* we don't use seqnum for pure ACKs */
-    sendpkt.acknum = packet.seqnum;   /* echo back the packet's seq as ACK */
+void A_input(const struct pkt *packet)
+{
+  Input(A, packet);
+}
 
+void B_input(const struct pkt *packet)
+{
+  Input(B, packet);
+}
 
-    /* we don't have any data to send.  fill payload with 0's */
-    for ( i=0; i<20 ; i++ )
-      sendpkt.payload[i] = '0';
+/* called when the emulator's timer of AorB goes off */
+static void TimerInterrupt(int AorB)
+{
+  struct sr *sr = protocol_state();
+  struct endpoint *ep = &sr->ep[AorB];
 
-    /* computer checksum */
-    sendpkt.checksum = ComputeChecksum(sendpkt);
+  ep->timerrunning = false;
+  ResendExpired(AorB);
 
-    /* send out packet */
-    tolayer3 (B, sendpkt);
+  /* the held back ACK has waited long enough, unless it went along with the resent data */
+  if (ep->pendingacks > 0 && ep->acktime <= get_sim_time() + TIMER_SLACK) {
+    if (TRACE > 0)
+      printf("----%c: ACK delay is over, send ACK!\n", NAME(AorB));
+    SendAck(AorB, ep->lastseqnum);
   }
+
+  SetTimer(AorB);   /* restart timer for the next logical timer to expire */
+}
+
+void A_timerinterrupt(void)
+{
+  TimerInterrupt(A);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
 void B_init(void)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  struct sr *sr = protocol_state();
+
+  sr->ep[A].expectedseqnum = 0;
+  sr->ep[B].expectedseqnum = 0;
 }
 
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
 
-/* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+/* with simplex transfer from A to B the emulator never calls B_output() */
+void B_output(const struct msg *message)
 {
+  Output(B, message);
 }
 
 /* called when B's timer goes off */
 void B_timerinterrupt(void)
 {
+  TimerInterrupt(B);
 }
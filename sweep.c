@@ -0,0 +1,285 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "sim.h"
+
+/* ******************************************************************
+   Parameter sweep driver for the network emulator.
+
+   Every key=value argument is passed to each simulation.  A value that
+   is a comma separated list (loss=0,0.1,0.2) makes that key an axis of
+   the grid, and the cartesian product of all axes is simulated.  Each
+   grid point is repeated reps=N times with seeds seed, seed+1, ...
+   The runs are spread over threads=N worker threads and one CSV line
+   with the mean and 95% confidence interval of each metric is printed
+   per grid point.  The files a run writes (evlog=, statsfile=,
+   snapshotfile=, checkpoint=) get ".point.rep" appended to their name,
+   so the runs of the threads do not share them.
+**********************************************************************/
+
+#define MAXAXES    16
+#define MAXVALUES  64
+#define MAXARG     300
+
+struct axis {
+  const char *key;
+  int keylen;
+  char *values[MAXVALUES];
+  int nvalues;
+};
+
+static struct axis axes[MAXAXES];
+static int naxes = 0;
+static char **fixed;              /* key=value arguments with a single value */
+static int nfixed = 0;
+static int reps = 5;              /* runs per grid point */
+static unsigned long baseseed = 9999;
+
+/* the metrics reported for every grid point */
+#define NMETRICS 7
+static const char *metricnames[NMETRICS] = {
+  "delivered", "goodput", "resent_per_delivered", "window_full", "end_time",
+  "latency_mean", "latency_p99"
+};
+
+struct job {
+  int point;                      /* index into the grid */
+  int rep;                        /* repetition, selects the seed */
+  double metrics[NMETRICS];
+};
+
+/* parameters naming a file that each run writes */
+static const char *runfiles[] = { "evlog", "statsfile", "snapshotfile", "checkpoint", NULL };
+
+static struct job *jobs;
+static int njobs;
+static int nextjob = 0;           /* next job to hand out, protected by joblock */
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+
+/* set the grid point's axis values and the job's seed on a new simulation */
+static struct sim *buildsim(int point, int rep)
+{
+  struct sim *s = sim_new();
+  const char *file;
+  char arg[MAXARG];
+  int i, v, p = point;
+
+  sim_set(s, "trace=0");          /* can be overridden by the arguments */
+  for (i = 0; i < nfixed; i++)
+    sim_set(s, fixed[i]);
+  for (i = 0; i < naxes; i++) {   /* point is a mixed radix number, one digit per axis */
+    v = p % axes[i].nvalues;
+    p /= axes[i].nvalues;
+    sprintf(arg, "%.*s=%s", axes[i].keylen, axes[i].key, axes[i].values[v]);
+    sim_set(s, arg);
+  }
+  sprintf(arg, "seed=%lu", baseseed + rep);
+  sim_set(s, arg);
+  for (i = 0; runfiles[i] != NULL; i++)
+    if ((file = sim_get(s, runfiles[i])) != NULL &&
+        (snprintf(arg, sizeof(arg), "%s=%s.%d.%d", runfiles[i], file, point, rep) >= (int)sizeof(arg) ||
+         !sim_set(s, arg))) {
+      printf("the file name of %s is too long\n", runfiles[i]);
+      exit(EXIT_FAILURE);
+    }
+  sim_configure(s, 0);
+  return s;
+}
+
+static void runjob(struct job *job)
+{
+  struct sim *s = buildsim(job->point, job->rep);
+  struct sim_results r;
+
+  sim_run(s);
+  if (job == &jobs[0])
+    sim_checkoptions(s);          /* report typos once, not for every run */
+  sim_results(s, &r);
+  sim_free(s);
+
+  job->metrics[0] = r.messages_delivered;
+  job->metrics[1] = r.goodput;
+  job->metrics[2] = r.messages_delivered > 0 ? (double)r.packets_resent / r.messages_delivered : 0.0;
+  job->metrics[3] = r.window_full;
+  job->metrics[4] = r.end_time;
+  job->metrics[5] = r.latency_mean;
+  job->metrics[6] = r.latency_p99;
+}
+
+static void *worker(void *arg)
+{
+  int j;
+
+  (void)arg;
+  while (1) {
+    pthread_mutex_lock(&joblock);
+    j = nextjob++;
+    pthread_mutex_unlock(&joblock);
+    if (j >= njobs)
+      break;
+    runjob(&jobs[j]);
+  }
+  return NULL;
+}
+
+/* two sided 95% critical value of Student's t distribution */
+static double tcritical(int df)
+{
+  static const double t95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+
+  if (df < 1)
+    return 0.0;
+  return df <= 30 ? t95[df-1] : 1.960;
+}
+
+static void printpoint(int point)
+{
+  double sum, sumsq, mean, var;
+  int i, m, v, p = point;
+
+  for (i = 0; i < naxes; i++) {
+    v = p % axes[i].nvalues;
+    p /= axes[i].nvalues;
+    printf("%s,", axes[i].values[v]);
+  }
+  printf("%d", reps);
+  for (m = 0; m < NMETRICS; m++) {
+    sum = sumsq = 0.0;
+    for (i = 0; i < reps; i++) {
+      sum += jobs[point*reps + i].metrics[m];
+      sumsq += jobs[point*reps + i].metrics[m] * jobs[point*reps + i].metrics[m];
+    }
+    mean = sum / reps;
+    var = reps > 1 ? (sumsq - reps*mean*mean) / (reps - 1) : 0.0;
+    if (var < 0.0)
+      var = 0.0;
+    printf(",%g,%g", mean, tcritical(reps - 1) * sqrt(var / reps));
+  }
+  printf("\n");
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [key=value ...] [key=v1,v2,... ...]\n", prog);
+  printf("  threads=N       worker threads (default: number of cpus)\n");
+  printf("  reps=N          runs per grid point, seeds seed..seed+N-1 (default 5)\n");
+  printf("  seed=N          first seed (default 9999)\n");
+  printf("simulation parameters (a comma separated list makes a grid axis),\n");
+  printf("the files of evlog=, statsfile=, snapshotfile= and checkpoint= are named FILE.point.rep:\n");
+  sim_usage();
+}
+
+static int intarg(const char *arg, const char *value)
+{
+  char *end;
+  long v = strtol(value, &end, 10);
+
+  if (*value == '\0' || *end != '\0' || v < 1) {
+    printf("invalid value for %s\n", arg);
+    exit(EXIT_FAILURE);
+  }
+  return (int)v;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t *threads;
+  char *arg, *eq, *v;
+  long ncpus;
+  int nthreads, npoints = 1;
+  int i;
+
+  ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  nthreads = ncpus > 0 ? (int)ncpus : 1;
+  fixed = malloc(argc * sizeof(char *));
+  if (fixed == 0) {
+    printf("memory allocation failed.");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 1; i < argc; i++) {
+    arg = argv[i];
+    while (*arg == '-')
+      arg++;
+    if (strcmp(arg, "h") == 0 || strcmp(arg, "help") == 0) {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if ((eq = strchr(arg, '=')) == NULL || eq == arg || strlen(arg) >= MAXARG) {
+      printf("unrecognised argument %s\n", argv[i]);
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    if (strncmp(arg, "threads=", 8) == 0)
+      nthreads = intarg("threads", eq+1);
+    else if (strncmp(arg, "reps=", 5) == 0)
+      reps = intarg("reps", eq+1);
+    else if (strncmp(arg, "seed=", 5) == 0)
+      baseseed = strtoul(eq+1, NULL, 10);
+    else if (strchr(eq+1, ',') == NULL)
+      fixed[nfixed++] = arg;
+    else {                        /* a grid axis */
+      if (naxes == MAXAXES) {
+        printf("at most %d parameters can be swept\n", MAXAXES);
+        return EXIT_FAILURE;
+      }
+      axes[naxes].key = arg;
+      axes[naxes].keylen = (int)(eq - arg);
+      for (v = strtok(eq+1, ","); v != NULL; v = strtok(NULL, ",")) {
+        if (axes[naxes].nvalues == MAXVALUES) {
+          printf("at most %d values can be given for %.*s\n", MAXVALUES, axes[naxes].keylen, arg);
+          return EXIT_FAILURE;
+        }
+        axes[naxes].values[axes[naxes].nvalues++] = v;
+      }
+      npoints *= axes[naxes].nvalues;
+      naxes++;
+    }
+  }
+
+  /* check every grid point's parameters before starting any run */
+  for (i = 0; i < npoints; i++)
+    sim_free(buildsim(i, 0));
+
+  njobs = npoints * reps;
+  jobs = calloc(njobs, sizeof(struct job));
+  threads = malloc(nthreads * sizeof(pthread_t));
+  if (jobs == 0 || threads == 0) {
+    printf("memory allocation failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < njobs; i++) {
+    jobs[i].point = i / reps;
+    jobs[i].rep = i % reps;
+  }
+
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+      printf("unable to start worker thread\n");
+      exit(EXIT_FAILURE);
+    }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  for (i = 0; i < naxes; i++)
+    printf("%.*s,", axes[i].keylen, axes[i].key);
+  printf("runs");
+  for (i = 0; i < NMETRICS; i++)
+    printf(",%s_mean,%s_ci95", metricnames[i], metricnames[i]);
+  printf("\n");
+  for (i = 0; i < npoints; i++)
+    printpoint(i);
+
+  free(threads);
+  free(jobs);
+  free(fixed);
+  return EXIT_SUCCESS;
+}
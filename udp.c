@@ -0,0 +1,733 @@
+#define _GNU_SOURCE     /* sendmmsg(), recvmmsg() */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "emulator.h"
+#include "gbn.h"
+
+#ifndef __linux__
+#error "udp.c needs Linux: epoll, timerfd, sendmmsg and recvmmsg"
+#endif
+
+/* ******************************************************************
+   UDP backend: runs the protocol over real sockets instead of the
+   emulator.  It provides the same interface (emulator.h), so gbn.c and
+   sr.c are linked in unchanged.
+
+   role=A and role=B run one side each, normally on two hosts:
+     gbn_udp role=B addr=0.0.0.0:45001 peer=hostA:45000 messages=10000
+     gbn_udp role=A addr=0.0.0.0:45000 peer=hostB:45001 messages=10000 lambda=1
+   role=both (the default) runs A and B in one process on two loopback
+   sockets, port= and port+1, which also gives the message latency.
+
+   - one epoll loop waits for the sockets and for timerfds: the
+   protocol's timer of each side and the arrival of the next message
+   - packets are read with recvmmsg() in batches of BATCH, and the
+   packets a wakeup produces go out together with sendmmsg()
+   - time is counted in time units of timeunit= seconds (a millisecond
+   by default), so the protocols' timeouts mean the same as in the
+   emulator.  Messages arrive every 0 to 2 * lambda time units as there
+   - on the wire a packet is seqnum, acknum and checksum as 32 bit
+   numbers in network byte order, followed by the payload
+   - loss=P drops packets on sending, for tests on one machine
+   - a side stops once it has given all its messages to the protocol,
+   its timer is not running and no packet came in for idle= seconds.
+   With role=A or role=B the countdown starts with the first packet, so
+   B can be started long before A, and a side that has not heard from
+   its peer after wait= seconds gives up
+**********************************************************************/
+
+#define BATCH       32        /* datagrams per recvmmsg()/sendmmsg() call */
+#define HEADERBYTES 12        /* seqnum, acknum, checksum */
+#define PAYLOAD     20        /* default payload size, as in the emulator */
+#define DEFAULT_PORT 45000
+#define TIMEUNIT    0.001     /* default seconds per time unit */
+#define IDLE        2.0       /* default seconds without packets before stopping */
+#define WAIT        60.0      /* default seconds to wait for the peer's first packet */
+#define MAXOPTIONS  64
+
+#ifndef TRACE_LEVEL
+int TRACE = 0;
+#endif
+
+/* what an epoll event is about, the entity is in the low bit */
+#define EV_SOCKET  0
+#define EV_TIMER   2
+#define EV_ARRIVAL 4
+
+/* one side of the connection, run by this process or not */
+struct side {
+  int local;                    /* does this process run it? */
+  int sock;                     /* UDP socket, connected to the other side */
+  int timerfd;                  /* the protocol's timer */
+  int arrivalfd;                /* the next message from layer 5 */
+  int timerrunning;
+  int sends;                    /* messages from layer 5 still to come */
+
+  /* packets waiting for sendmmsg() */
+  struct mmsghdr out[BATCH];
+  struct iovec outiov[BATCH];
+  char *outbuf;                 /* BATCH wire packets */
+  int nout;
+
+  /* counters */
+  int generated;                /* messages given to A_output()/B_output() */
+  int refused;                  /* of which the window was full */
+  int packetssent;
+  int packetslost;              /* dropped by loss= */
+  int senddrops;                /* the socket buffer was full */
+  int packetsreceived;
+  int badpackets;               /* datagrams of the wrong size */
+  int delivered;                /* messages given to tolayer5() */
+  double firstdelivery, lastdelivery;
+  double cwnd;                  /* latest protocol_cwnd() */
+};
+
+static struct side sides[2];
+static struct protocol_stats pstats;
+static void *proto;
+static int payloadsize = PAYLOAD;
+static double timeunit = TIMEUNIT;
+static double lambda;
+static double lossprob;
+static struct timespec start;
+static uint64_t rngstate;
+
+/* message latency with role=both: the acceptance times of the messages
+   A still has to deliver, oldest first */
+static double *accepttimes;
+static int acceptfirst, naccepted, maxaccepted;
+static double latencysum, latencymax;
+static int nlatencies;
+
+/* parameters, key=value arguments */
+static char **options;
+static int noptions;
+static int optused[MAXOPTIONS];
+
+static void fail(const char *what)
+{
+  printf("%s: %s\n", what, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+/* seconds since the start */
+static double now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - start.tv_sec) + (t.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+/* splitmix64, uniform on [0,1) */
+static double uniform(void)
+{
+  uint64_t z = (rngstate += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/********************* PARAMETERS ********************/
+
+/* value of parameter key, the last one given wins, or NULL */
+static const char *getoption(const char *key)
+{
+  size_t len = strlen(key);
+  const char *value = NULL;
+  int i;
+
+  for (i = 0; i < noptions; i++)
+    if (strncmp(options[i], key, len) == 0 && options[i][len] == '=') {
+      value = options[i] + len + 1;
+      optused[i] = 1;
+    }
+  return value;
+}
+
+static void badoption(const char *key, const char *value)
+{
+  printf("invalid value \"%s\" for parameter %s\n", value, key);
+  exit(EXIT_FAILURE);
+}
+
+static double floatoption(const char *key, double defvalue)
+{
+  const char *str = getoption(key);
+  char *end;
+  double v;
+
+  if (str == NULL)
+    return defvalue;
+  v = strtod(str, &end);
+  if (*str == '\0' || *end != '\0')
+    badoption(key, str);
+  return v;
+}
+
+static int intoption(const char *key, int defvalue)
+{
+  const char *str = getoption(key);
+  char *end;
+  long v;
+
+  if (str == NULL)
+    return defvalue;
+  v = strtol(str, &end, 10);
+  if (*str == '\0' || *end != '\0')
+    badoption(key, str);
+  return (int)v;
+}
+
+/* HOST:PORT, or just :PORT for any address */
+static void parseaddr(const char *key, const char *str, struct sockaddr_storage *addr, socklen_t *len)
+{
+  char host[256];
+  const char *colon = strrchr(str, ':');
+  struct addrinfo hints, *res;
+
+  if (colon == NULL || (size_t)(colon - str) >= sizeof(host))
+    badoption(key, str);
+  memcpy(host, str, colon - str);
+  host[colon - str] = '\0';
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(host[0] != '\0' ? host : NULL, colon + 1, &hints, &res) != 0)
+    badoption(key, str);
+  memcpy(addr, res->ai_addr, res->ai_addrlen);
+  *len = res->ai_addrlen;
+  freeaddrinfo(res);
+}
+
+/********************* THE EMULATOR INTERFACE ********/
+
+struct protocol_stats *protocol_stats(void)
+{
+  return &pstats;
+}
+
+void *protocol_state(void)
+{
+  return proto;
+}
+
+/* the process ends with the run, so the blocks are never freed */
+void *protocol_alloc(size_t size)
+{
+  void *p = calloc(1, size);
+
+  if (p == NULL) {
+    printf("memory allocation for protocol buffers failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* no checkpoints here, nothing has to be moved */
+void protocol_pointer(void *field)
+{
+  (void)field;
+}
+
+int protocol_option(const char *key, int defvalue)
+{
+  return intoption(key, defvalue);
+}
+
+double protocol_float_option(const char *key, double defvalue)
+{
+  return floatoption(key, defvalue);
+}
+
+const char *protocol_string_option(const char *key, const char *defvalue)
+{
+  const char *value = getoption(key);
+
+  return value != NULL ? value : defvalue;
+}
+
+void protocol_badoption(const char *key, const char *why)
+{
+  printf("invalid value \"%s\" for parameter %s: %s\n", getoption(key), key, why);
+  exit(EXIT_FAILURE);
+}
+
+void protocol_cwnd(int AorB, double cwnd, double ssthresh)
+{
+  if (TRACE>2)
+    printf("          CWND: %s cwnd %.3f ssthresh %.3f\n", AorB == A ? "A" : "B", cwnd, ssthresh);
+  sides[AorB].cwnd = cwnd;
+}
+
+double get_sim_time(void)
+{
+  return now() / timeunit;
+}
+
+int get_payload_size(void)
+{
+  return payloadsize;
+}
+
+/* arm a timerfd to go off after t seconds, 0 disarms it */
+static void settimerfd(int fd, double t)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  if (t > 0) {
+    its.it_value.tv_sec = (time_t)t;
+    its.it_value.tv_nsec = (long)((t - (double)its.it_value.tv_sec) * 1e9);
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+      its.it_value.tv_nsec = 1;     /* all zero would disarm it */
+  }
+  if (timerfd_settime(fd, 0, &its, NULL) < 0)
+    fail("timerfd_settime");
+}
+
+void stoptimer(int AorB)
+{
+  struct side *sd = &sides[AorB];
+
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer at %f\n", get_sim_time());
+  if (!sd->timerrunning) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  settimerfd(sd->timerfd, 0.0);
+  sd->timerrunning = 0;
+}
+
+void starttimer(int AorB, double increment)
+{
+  struct side *sd = &sides[AorB];
+
+  if (TRACE>1)
+    printf("          START TIMER: starting timer at %f\n", get_sim_time());
+  if (sd->timerrunning) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  /* even a timer that expires at once has to go off from the loop */
+  settimerfd(sd->timerfd, increment > 0 ? increment * timeunit : 1e-9);
+  sd->timerrunning = 1;
+}
+
+/* send out the packets that have been batched up for the other side */
+static void flush(struct side *sd)
+{
+  int i = 0, n;
+
+  while (i < sd->nout) {
+    n = sendmmsg(sd->sock, sd->out + i, sd->nout - i, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+        fail("sendmmsg");
+      /* UDP may drop: the socket buffer is full or the other side
+         is not there yet, the protocol resends */
+      sd->senddrops += sd->nout - i;
+      break;
+    }
+    i += n;
+  }
+  sd->nout = 0;
+}
+
+void tolayer3(int AorB, const struct pkt *packet)
+{
+  struct side *sd = &sides[AorB];
+  unsigned char *wire;
+  uint32_t field[3];
+  size_t size = HEADERBYTES + (size_t)payloadsize;
+
+  if (TRACE>2)
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d\n", packet->seqnum, packet->acknum, packet->checksum);
+  if (lossprob > 0 && uniform() < lossprob) {
+    sd->packetslost++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    return;
+  }
+  if (sd->nout == BATCH)
+    flush(sd);
+  wire = (unsigned char *)sd->outbuf + sd->nout * size;
+  field[0] = htonl((uint32_t)packet->seqnum);
+  field[1] = htonl((uint32_t)packet->acknum);
+  field[2] = htonl((uint32_t)packet->checksum);
+  memcpy(wire, field, HEADERBYTES);
+  memcpy(wire + HEADERBYTES, packet->payload, payloadsize);
+  sd->outiov[sd->nout].iov_base = wire;
+  sd->outiov[sd->nout].iov_len = size;
+  memset(&sd->out[sd->nout], 0, sizeof(sd->out[sd->nout]));
+  sd->out[sd->nout].msg_hdr.msg_iov = &sd->outiov[sd->nout];
+  sd->out[sd->nout].msg_hdr.msg_iovlen = 1;
+  sd->nout++;
+  sd->packetssent++;
+}
+
+void tolayer5(int AorB, const char *datasent)
+{
+  struct side *sd = &sides[AorB];
+  double t = now(), latency;
+
+  if (TRACE>2)
+    printf("          TOLAYER5: data received by application at %s: %.*s\n",
+           AorB == A ? "A" : "B", payloadsize < 20 ? payloadsize : 20, datasent);
+  if (sd->delivered++ == 0)
+    sd->firstdelivery = t;
+  sd->lastdelivery = t;
+
+  /* with both sides here, this is the oldest message the other one accepted */
+  if (AorB == B && sides[A].local && naccepted > 0) {
+    latency = (t - accepttimes[acceptfirst]) / timeunit;
+    acceptfirst = (acceptfirst + 1) % maxaccepted;
+    naccepted--;
+    latencysum += latency;
+    if (latency > latencymax)
+      latencymax = latency;
+    nlatencies++;
+  }
+}
+
+/********************* THE EVENT LOOP ****************/
+
+static void messageaccepted(void)
+{
+  double *ring;
+  int i;
+
+  if (naccepted == maxaccepted) {
+    maxaccepted = maxaccepted ? 2 * maxaccepted : 64;
+    if ((ring = malloc(maxaccepted * sizeof(double))) == NULL) {
+      printf("memory allocation for latency ring failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < naccepted; i++)
+      ring[i] = accepttimes[(acceptfirst + i) % (maxaccepted / 2)];
+    free(accepttimes);
+    accepttimes = ring;
+    acceptfirst = 0;
+  }
+  accepttimes[(acceptfirst + naccepted) % maxaccepted] = now();
+  naccepted++;
+}
+
+/* the next message arrives 0 to 2 * lambda time units from now */
+static void nextarrival(struct side *sd)
+{
+  if (sd->sends > 0)
+    settimerfd(sd->arrivalfd, 2.0 * lambda * uniform() * timeunit + 1e-9);
+}
+
+/* layer 5 of AorB has a message for the protocol */
+static void arrival(int AorB)
+{
+  struct side *sd = &sides[AorB];
+  struct msg message;
+  int refused = pstats.window_full;
+
+  memset(message.data, 97 + sd->generated % 26, payloadsize);
+  sd->generated++;
+  sd->sends--;
+  if (TRACE>2)
+    printf("          MAINLOOP: data given to student: %.*s\n", payloadsize < 20 ? payloadsize : 20, message.data);
+  if (AorB == A)
+    A_output(&message);
+  else
+    B_output(&message);
+  if (pstats.window_full != refused)
+    sd->refused++;
+  else if (AorB == A && sides[B].local)
+    messageaccepted();
+  nextarrival(sd);
+}
+
+/* read whatever is waiting on the socket of AorB and hand it to the
+   protocol, returns the number of datagrams read */
+static int receive(int AorB)
+{
+  static struct mmsghdr in[BATCH];
+  static struct iovec iniov[BATCH];
+  static char *inbuf;
+  static struct pkt *packet;
+  struct side *sd = &sides[AorB];
+  size_t size = HEADERBYTES + (size_t)payloadsize;
+  uint32_t field[3];
+  int i, n, total = 0;
+
+  if (inbuf == NULL) {
+    /* one byte more, so a datagram that is too long shows */
+    if ((inbuf = malloc(BATCH * (size + 1))) == NULL ||
+        (packet = malloc(sizeof(struct pkt))) == NULL) {
+      printf("memory allocation for receive buffers failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  while (1) {
+    for (i = 0; i < BATCH; i++) {
+      iniov[i].iov_base = inbuf + i * (size + 1);
+      iniov[i].iov_len = size + 1;
+      memset(&in[i], 0, sizeof(in[i]));
+      in[i].msg_hdr.msg_iov = &iniov[i];
+      in[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(sd->sock, in, BATCH, 0, NULL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED)
+        return total;   /* ECONNREFUSED: the peer is not there (yet) */
+      fail("recvmmsg");
+    }
+    total += n;
+    for (i = 0; i < n; i++) {
+      if (in[i].msg_len != size) {
+        sd->badpackets++;
+        continue;
+      }
+      memcpy(field, iniov[i].iov_base, HEADERBYTES);
+      packet->seqnum = (int)ntohl(field[0]);
+      packet->acknum = (int)ntohl(field[1]);
+      packet->checksum = (int)ntohl(field[2]);
+      memcpy(packet->payload, (char *)iniov[i].iov_base + HEADERBYTES, payloadsize);
+      sd->packetsreceived++;
+      if (AorB == A)
+        A_input(packet);
+      else
+        B_input(packet);
+    }
+    if (n < BATCH)
+      return total;
+  }
+}
+
+static void timerexpired(int AorB)
+{
+  sides[AorB].timerrunning = 0;
+  if (TRACE>=2)
+    printf("\nEVENT time: %f,  type: 0, timerinterrupt   entity: %d\n", get_sim_time(), AorB);
+  if (AorB == A)
+    A_timerinterrupt();
+  else
+    B_timerinterrupt();
+}
+
+/* a bound, non-blocking UDP socket connected to peer */
+static int opensocket(const char *addrkey, const char *addrstr, const char *peerkey, const char *peerstr)
+{
+  struct sockaddr_storage addr, peer;
+  socklen_t addrlen, peerlen;
+  int fd;
+
+  parseaddr(addrkey, addrstr, &addr, &addrlen);
+  parseaddr(peerkey, peerstr, &peer, &peerlen);
+  if ((fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0)
+    fail("socket");
+  if (bind(fd, (struct sockaddr *)&addr, addrlen) < 0)
+    fail("bind");
+  if (connect(fd, (struct sockaddr *)&peer, peerlen) < 0)
+    fail("connect");
+  return fd;
+}
+
+static void watch(int epfd, int fd, uint32_t what)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = what;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    fail("epoll_ctl");
+}
+
+static void report(int AorB)
+{
+  struct side *sd = &sides[AorB];
+  double span = sd->lastdelivery - sd->firstdelivery;
+
+  printf("%c: %d messages from layer 5, %d refused (window full)\n", AorB == A ? 'A' : 'B',
+         sd->generated, sd->refused);
+  printf("   %d packets sent, %d lost by loss=, %d dropped by the socket, %d received, %d malformed\n",
+         sd->packetssent, sd->packetslost, sd->senddrops, sd->packetsreceived, sd->badpackets);
+  if (sd->delivered > 0)
+    printf("   %d messages delivered in %f s: %f per second, %f per time unit\n", sd->delivered, span,
+           span > 0 ? sd->delivered / span : 0.0, span > 0 ? sd->delivered / (span / timeunit) : 0.0);
+  if (sd->cwnd > 0)
+    printf("   congestion window at the end: %.2f\n", sd->cwnd);
+}
+
+int main(int argc, char **argv)
+{
+  struct epoll_event evs[16];
+  const char *role, *str;
+  char addrbuf[64], peerbuf[64];
+  double idle, wait, lastactivity = 0.0;
+  int heard;                        /* has a packet come in, or is the peer in this process? */
+  int epfd, messages, port, i, j, n, AorB, done;
+  uint64_t expirations;
+
+  for (i = 1; i < argc; i++)
+    if (strchr(argv[i], '=') == NULL || argc - 1 > MAXOPTIONS) {
+      printf("usage: %s [key=value ...]\n", argv[0]);
+      printf("  role=A|B|both   side(s) this process runs (default both, over loopback)\n");
+      printf("  addr=HOST:PORT  local address of role=A or role=B\n");
+      printf("  peer=HOST:PORT  address of the other side\n");
+      printf("  port=N          role=both: A uses port N, B port N+1 (default %d)\n", DEFAULT_PORT);
+      printf("  messages=N      messages each sending side gives to the protocol\n");
+      printf("  lambda=T        average time units between messages (default 1)\n");
+      printf("  timeunit=S      seconds per time unit (default %g)\n", TIMEUNIT);
+      printf("  payload=N       bytes of data in every message and packet (default %d)\n", PAYLOAD);
+      printf("  loss=P          drop packets with probability P on sending\n");
+      printf("  idle=S          stop after S seconds without packets (default %g)\n", IDLE);
+      printf("  wait=S          role=A|B: give up if the peer sent nothing in S seconds (default %g)\n", WAIT);
+      printf("  seed=N          seed for the message arrivals and loss=\n");
+      printf("  trace=N         TRACE level\n");
+      printf("  and the protocol's own parameters (window=, seqspace=, cc=, ...)\n");
+      return EXIT_FAILURE;
+    }
+  options = argv + 1;
+  noptions = argc - 1;
+
+  role = getoption("role");
+  if (role == NULL || strcmp(role, "both") == 0)
+    sides[A].local = sides[B].local = 1;
+  else if (strcmp(role, "A") == 0)
+    sides[A].local = 1;
+  else if (strcmp(role, "B") == 0)
+    sides[B].local = 1;
+  else
+    badoption("role", role);
+  messages = intoption("messages", 0);
+  lambda = floatoption("lambda", 1.0);
+  timeunit = floatoption("timeunit", TIMEUNIT);
+  payloadsize = intoption("payload", PAYLOAD);
+  lossprob = floatoption("loss", 0.0);
+  idle = floatoption("idle", IDLE);
+  wait = floatoption("wait", WAIT);
+  rngstate = (uint64_t)floatoption("seed", 9999);
+#ifndef TRACE_LEVEL
+  TRACE = intoption("trace", 0);
+#endif
+  if (messages < 0 || lambda < 0 || timeunit <= 0 || idle <= 0 || wait <= 0 || lossprob < 0 || lossprob > 1)
+    badoption("messages, lambda, timeunit, idle, wait or loss", "out of range");
+  if (payloadsize < 1 || payloadsize > MAXPAYLOAD)
+    badoption("payload", getoption("payload"));
+
+  if ((epfd = epoll_create1(0)) < 0)
+    fail("epoll_create1");
+  port = intoption("port", DEFAULT_PORT);
+  for (AorB = A; AorB <= B; AorB++) {
+    struct side *sd = &sides[AorB];
+
+    if (!sd->local)
+      continue;
+    if (sides[A].local && sides[B].local) {
+      snprintf(addrbuf, sizeof(addrbuf), "127.0.0.1:%d", AorB == A ? port : port + 1);
+      snprintf(peerbuf, sizeof(peerbuf), "127.0.0.1:%d", AorB == A ? port + 1 : port);
+      sd->sock = opensocket("port", addrbuf, "port", peerbuf);
+    }
+    else {
+      if ((str = getoption("addr")) == NULL || getoption("peer") == NULL) {
+        printf("role=%c needs addr= and peer=\n", AorB == A ? 'A' : 'B');
+        return EXIT_FAILURE;
+      }
+      sd->sock = opensocket("addr", str, "peer", getoption("peer"));
+    }
+    if ((sd->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0 ||
+        (sd->arrivalfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0)
+      fail("timerfd_create");
+    if ((sd->outbuf = malloc(BATCH * (HEADERBYTES + (size_t)payloadsize))) == NULL) {
+      printf("memory allocation for send buffers failed.");
+      return EXIT_FAILURE;
+    }
+    watch(epfd, sd->sock, EV_SOCKET | AorB);
+    watch(epfd, sd->timerfd, EV_TIMER | AorB);
+    watch(epfd, sd->arrivalfd, EV_ARRIVAL | AorB);
+  }
+
+  /* the protocol state holds both sides, B_init() relies on A_init() */
+  if ((proto = calloc(1, protocol_state_size)) == NULL) {
+    printf("memory allocation for protocol state failed.");
+    return EXIT_FAILURE;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  A_init();
+  B_init();
+  sides[A].sends = sides[A].local ? messages : 0;
+  sides[B].sends = sides[B].local && intoption("bidirectional", BIDIRECTIONAL) ? messages : 0;
+  for (AorB = A; AorB <= B; AorB++)
+    if (sides[AorB].local)
+      nextarrival(&sides[AorB]);
+  for (i = 0; i < noptions; i++)
+    if (!optused[i])
+      printf("Warning: unknown parameter %s ignored\n", options[i]);
+
+  heard = sides[A].local && sides[B].local;   /* role=both counts from the start */
+  done = 0;
+  while (!done) {
+    n = epoll_wait(epfd, evs, 16, 100);
+    if (n < 0 && errno != EINTR)
+      fail("epoll_wait");
+    for (j = 0; j < n; j++) {
+      AorB = evs[j].data.u32 & 1;
+      switch (evs[j].data.u32 & ~1u) {
+      case EV_SOCKET:
+        if (receive(AorB) > 0) {
+          lastactivity = now();
+          heard = 1;
+        }
+        break;
+      case EV_TIMER:
+        if (read(sides[AorB].timerfd, &expirations, sizeof(expirations)) > 0 && sides[AorB].timerrunning)
+          timerexpired(AorB);
+        break;
+      case EV_ARRIVAL:
+        if (read(sides[AorB].arrivalfd, &expirations, sizeof(expirations)) > 0)
+          arrival(AorB);
+        break;
+      }
+    }
+    for (AorB = A; AorB <= B; AorB++)
+      if (sides[AorB].local)
+        flush(&sides[AorB]);
+
+    /* nothing left to send or resend, and the other side has gone quiet */
+    done = heard && now() - lastactivity >= idle;
+    for (AorB = A; AorB <= B; AorB++)
+      if (sides[AorB].local && (sides[AorB].sends > 0 || sides[AorB].timerrunning))
+        done = 0;
+    if (!heard && now() >= wait) {
+      printf("no packet from the peer in %g seconds, giving up\n", wait);
+      done = 1;
+    }
+  }
+
+  for (AorB = A; AorB <= B; AorB++)
+    if (sides[AorB].local)
+      report(AorB);
+  printf("protocol: %d packets resent, %d new ACKs, %d ACKs sent, %d correct packets received\n",
+         pstats.packets_resent, pstats.new_ACKs, pstats.acks_sent, pstats.packets_received);
+  if (nlatencies > 0)
+    printf("message latency from layer 5 to layer 5:  mean %f  max %f time units\n",
+           latencysum / nlatencies, latencymax);
+  return EXIT_SUCCESS;
+}